@@ -12,6 +12,8 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To read a run of blocks into memory of your own without
+//     caching them, call breadn.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
@@ -25,6 +27,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "slab.h"
 
 struct {
   struct spinlock lock;
@@ -35,12 +38,24 @@ struct {
   struct buf head;
 } bcache;
 
+// Request headers for breadn(), which reads around the cache.
+static struct kmem_cache dbufcache;
+
+#define MAXRUN 64  // most blocks in one breadn() disk request
+
+static void
+dbufctor(void *obj)
+{
+  initsleeplock(&((struct buf*)obj)->lock, "dbuf");
+}
+
 void
 binit(void)
 {
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  kmem_cache_init(&dbufcache, "dbuf", sizeof(struct buf), dbufctor);
 
 //PAGEBREAK!
   // Create linked list of buffers
@@ -139,6 +154,86 @@ brelse(struct buf *b)
   
   release(&bcache.lock);
 }
+// Is the block in the cache? If so, return its buffer, locked,
+// without reading the block from disk.
+static struct buf*
+bpeek(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno && (b->refcnt || (b->flags & B_VALID))){
+      b->refcnt++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      if(b->flags & B_VALID)
+        return b;
+      brelse(b);  // its reader failed; go to disk ourselves
+      return 0;
+    }
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Does the cache hold a valid or in-use buffer for the block?
+static int
+bcached(uint dev, uint blockno)
+{
+  struct buf *b;
+  int r;
+
+  r = 0;
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno && (b->refcnt || (b->flags & B_VALID))){
+      r = 1;
+      break;
+    }
+  release(&bcache.lock);
+  return r;
+}
+
+// Read n consecutive blocks of dev, starting at blockno, into addr
+// without caching them. Blocks the cache holds are copied from it,
+// since they may be newer than the disk (written by a transaction
+// not yet installed); each run of the others is read with a single
+// disk request straight into addr. The caller must keep the blocks
+// from being written meanwhile, e.g. by holding the inode lock.
+void
+breadn(uint dev, uint blockno, uint n, char *addr)
+{
+  struct buf *b;
+  uint i, run;
+
+  for(i = 0; i < n; i += run){
+    run = 1;
+    if((b = bpeek(dev, blockno + i)) != 0){
+      memmove(addr + i*BSIZE, b->data, BSIZE);
+      brelse(b);
+      continue;
+    }
+    if((b = kmem_cache_alloc(&dbufcache)) == 0){
+      b = bread(dev, blockno + i);
+      memmove(addr + i*BSIZE, b->data, BSIZE);
+      brelse(b);
+      continue;
+    }
+    while(i + run < n && run < MAXRUN && !bcached(dev, blockno + i + run))
+      run++;
+    b->dev = dev;
+    b->blockno = blockno + i;
+    b->flags = 0;
+    b->addr = (uchar*)addr + i*BSIZE;
+    b->nblock = run;
+    acquiresleep(&b->lock);
+    iderw(b);
+    releasesleep(&b->lock);
+    kmem_cache_free(&dbufcache, b);
+  }
+}
+
 //PAGEBREAK!
 // Blank page.
 
@@ -7,6 +7,9 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
+  uchar *addr;  // direct request (breadn()): transfer here, not data
+  uint nblock;  // direct request: blocks to transfer
+  uint nsect;   // direct request: sectors transferred so far
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
@@ -236,16 +236,25 @@ int
 consoleread(struct inode *ip, char *dst, int n)
 {
   uint target;
-  int c;
+  int c, excl;
 
-  iunlock(ip);
+  // readi() callers may hold ip shared or exclusively; drop it
+  // while waiting for input and take it back the same way.
+  excl = holdingsleep(&ip->lock);
+  if(excl)
+    iunlock(ip);
+  else
+    iunlockshared(ip);
   target = n;
   acquire(&cons.lock);
   while(n > 0){
     while(input.r == input.w){
       if(myproc()->killed){
         release(&cons.lock);
-        ilock(ip);
+        if(excl)
+          ilock(ip);
+        else
+          ilockshared(ip);
         return -1;
       }
       sleep(&input.r, &cons.lock);
@@ -265,7 +274,10 @@ consoleread(struct inode *ip, char *dst, int n)
       break;
   }
   release(&cons.lock);
-  ilock(ip);
+  if(excl)
+    ilock(ip);
+  else
+    ilockshared(ip);
 
   return target - n;
 }
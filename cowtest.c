@@ -0,0 +1,104 @@
+// Tests for copy-on-write fork.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define SZ  (4*1024*1024)
+
+// parent and children write to the same shared heap and
+// must each see only their own writes
+void
+cowwrite(void)
+{
+  char *p;
+  int i, n, pid;
+
+  printf(1, "cowwrite test\n");
+  p = sbrk(SZ);
+  if(p == (char*)-1){
+    printf(1, "sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < SZ; i += 4096)
+    p[i] = 'p';
+
+  for(n = 0; n < 3; n++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(i = 0; i < SZ; i += 4096){
+        if(p[i] != 'p'){
+          printf(1, "cowwrite: child saw %d\n", p[i]);
+          exit();
+        }
+        p[i] = '0' + n;
+      }
+      for(i = 0; i < SZ; i += 4096){
+        if(p[i] != '0' + n){
+          printf(1, "cowwrite: child lost its write\n");
+          exit();
+        }
+      }
+      exit();
+    }
+  }
+  for(n = 0; n < 3; n++)
+    wait();
+
+  for(i = 0; i < SZ; i += 4096){
+    if(p[i] != 'p'){
+      printf(1, "cowwrite: parent saw child write\n");
+      exit();
+    }
+  }
+  sbrk(-SZ);
+  printf(1, "cowwrite ok\n");
+}
+
+// the kernel writes into a shared page for read()
+void
+cowread(void)
+{
+  static char buf[4096];
+  int fds[2], pid;
+
+  printf(1, "cowread test\n");
+  buf[0] = 'p';
+  if(pipe(fds) != 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(read(fds[0], buf, 1) != 1 || buf[0] != 'c'){
+      printf(1, "cowread: read failed\n");
+      exit();
+    }
+    exit();
+  }
+  write(fds[1], "c", 1);
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  if(buf[0] != 'p'){
+    printf(1, "cowread: child read into parent's page\n");
+    exit();
+  }
+  printf(1, "cowread ok\n");
+}
+
+int
+main(void)
+{
+  cowwrite();
+  cowread();
+  exit();
+}
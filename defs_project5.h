@@ -2,6 +2,8 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct mmap_area;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,11 +11,13 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct swapstat;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            breadn(uint, uint, uint, char*);
 void            bwrite(struct buf*);
 
 // console.c
@@ -24,6 +28,10 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             execload(struct proc*, char*, char**, pde_t**, uint*);
+char*           execpage(struct proc*, uint, int*, int);
+void            execdup(struct proc*, struct proc*);
+void            exectrim(struct proc*, uint);
 
 // file.c
 struct file*    filealloc(void);
@@ -31,6 +39,7 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filereadmax(struct file*, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
 
@@ -40,16 +49,20 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            itext(struct inode*, int);
 void            iinit(int dev);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readipage(struct inode*, char*, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -65,7 +78,17 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kalloc_zeroed(void);
+extern char*    zeropage;
+int             kalloc_batch(char**, int);
+void            kzerofill(void);
+void            kref(char*);
+int             krefcount(char*);
 void            kfree(char*);
+int             freemem(void);
+char*           kalloc_pages(int);
+void            kfree_pages(char*, int);
+void            kfreecounts(int*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -78,6 +101,7 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(uchar, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -91,12 +115,22 @@ void            end_op();
 extern int      ismp;
 void            mpinit(void);
 
+// pagecache.c
+void            pcacheinit(void);
+char*           pcget(struct inode*, uint);
+void            pcinval(struct inode*, uint, uint);
+char*           pcpeek(struct inode*, uint);
+void            pcread(struct inode*, char*, uint, uint);
+int             pcshare(struct inode*, uint, char*, int);
+void            pcwrite(struct inode*, char*, uint, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
+void            pipeinit(void);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
@@ -106,6 +140,9 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             vfork(void);
+void            vforkdone(void);
+int             spawn(char*, char**, struct file**);
 int             growproc(int);
 int             kill(int);
 struct cpu*     mycpu(void);
@@ -120,7 +157,8 @@ void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
-int             freemem(void);
+int             getsyscount(int, uint*);
+void            resetsyscount(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -134,10 +172,18 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void            kmem_cache_init(struct kmem_cache*, char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
+void            downgradesleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -153,6 +199,7 @@ char*           strncpy(char*, const char*, int);
 int             argint(int, int*);
 int             arguint(int, uint*);
 int             argptr(int, char**, int);
+int             argbuf(int, char**, int, int, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -172,6 +219,12 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// vdso.c
+extern char     vdsopage[];
+void            vdsoinit(void);
+void            vdsoprocinit(char*, int);
+void            vdsotick(void);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -181,16 +234,33 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
+int             mapvdso(pde_t*, char*);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
+void            tlbflush(pde_t*, uint, uint);
+void            tlbintr(void);
 int             copyout(pde_t*, uint, void*, uint);
+int             cowpage(pde_t*, uint);
+int             lazypage(struct proc*, uint, int);
+int             prefault(uint, uint, int);
+void            unpinuser(void);
+int             faultkill(struct proc*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 int             mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm);
 
 uint            mmap(uint addr, int length, int prot, int flags, int fd, int offset);
 int             munmap(uint addr);
+void            mmapinit(void);
+void            swapinit(void);
+int             swapout(void);
+void            swapstat(struct swapstat*);
+struct mmap_area* findmmap(struct proc*, uint);
+int             mmapoverlap(struct proc*, uint, uint);
+int             mmapdup(struct proc*, struct proc*);
+int             mmapfault(struct mmap_area*, uint, int);
+int             mmappage(struct mmap_area*, uint, int, int);
+void            mmapexit(struct proc*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,21 +6,26 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "vdso.h"
 
+// Load the program at path for process p: build a new page
+// table holding p's vdso pages and a stack with argv, and record
+// the ELF segments so execpage() can page them in on demand.
+// On success, set p's name and entry registers and return the
+// page table in *pgdirp and its size in *szp. p's current
+// address space is left alone; the caller decides when to
+// switch to the new one. Used by exec() and spawn().
 int
-exec(char *path, char **argv)
+execload(struct proc *p, char *path, char **argv, pde_t **pgdirp, uint *szp)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe, *oldexe;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
-
-  curproc->nice = 20;  ///////////
-  curproc->weight = 1024;  ///////////
+  struct execseg seg[NEXECSEG];
+  pde_t *pgdir;
 
   begin_op();
 
@@ -29,8 +34,9 @@ exec(char *path, char **argv)
     cprintf("exec: fail\n");
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -40,9 +46,13 @@ exec(char *path, char **argv)
 
   if((pgdir = setupkvm()) == 0)
     goto bad;
+  if(mapvdso(pgdir, p->vdso) < 0)
+    goto bad;
 
-  // Load program into memory.
+  // Record the program's segments; their pages are read in on
+  // first touch by execpage().
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -50,17 +60,23 @@ exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > VDSOBASE)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < sz)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg == NEXECSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].memsz = ph.memsz;
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  itext(ip, 1);
+  iunlockshared(ip);
   end_op();
+  exe = ip;  // keep the reference for execpage()
   ip = 0;
 
   // Allocate two pages at the next page boundary.
@@ -94,24 +110,145 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  oldexe = p->exe;
+  p->exe = exe;
+  p->nseg = nseg;
+  memmove(p->seg, seg, sizeof(seg));
+  if(oldexe){
+    itext(oldexe, -1);
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
+  *pgdirp = pgdir;
+  *szp = sz;
   return 0;
 
  bad:
   if(pgdir)
     freevm(pgdir);
   if(ip){
-    iunlockput(ip);
+    iunlockshared(ip);
+    iput(ip);
+    end_op();
+  }
+  if(exe){
+    itext(exe, -1);
+    begin_op();
+    iput(exe);
     end_op();
   }
   return -1;
 }
+
+// Return a page holding the contents of p's memory at va, for
+// lazypage() to map with permissions *perm. Whole pages of the
+// program's segments come shared from the page cache and are
+// mapped copy-on-write; a page only partly backed by the file is
+// read into a private page, and the rest is zero. If the caller
+// will not write the page (write is 0), a page with nothing to read
+// in is the shared zero page, copy-on-write, rather than a new one.
+// May sleep.
+char*
+execpage(struct proc *p, uint va, int *perm, int write)
+{
+  struct execseg *s;
+  uint off, n;
+  char *mem;
+
+  *perm = PTE_W|PTE_U;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(va < s->va || va >= s->va + s->memsz)
+      continue;
+    if(va - s->va >= s->filesz)
+      break;
+    off = s->off + (va - s->va);
+    n = s->filesz - (va - s->va);
+    ilockshared(p->exe);
+    if(n >= PGSIZE && (mem = pcget(p->exe, off)) != 0){
+      iunlockshared(p->exe);
+      *perm = PTE_U|PTE_COW;
+      return mem;
+    }
+    if(n > PGSIZE)
+      n = PGSIZE;
+    if((mem = kalloc_zeroed()) != 0 && readi(p->exe, mem, off, n) != n){
+      kfree(mem);
+      mem = 0;
+    }
+    iunlockshared(p->exe);
+    return mem;
+  }
+  if(!write){
+    *perm = PTE_U|PTE_COW;
+    return zeropage;
+  }
+  return kalloc_zeroed();
+}
+
+// Give child np the executable and segments of p.
+void
+execdup(struct proc *np, struct proc *p)
+{
+  np->exe = 0;
+  if(p->exe){
+    // p is running it, so no write can be under way.
+    np->exe = idup(p->exe);
+    itext(np->exe, 1);
+  }
+  np->nseg = p->nseg;
+  memmove(np->seg, p->seg, sizeof(p->seg));
+}
+
+// The image has shrunk to sz: drop segment pages above it, so
+// growing again yields zeroed memory rather than file contents.
+void
+exectrim(struct proc *p, uint sz)
+{
+  struct execseg *s;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(s->va >= sz)
+      s->memsz = s->filesz = 0;
+    else if(s->va + s->memsz > sz){
+      s->memsz = sz - s->va;
+      if(s->filesz > s->memsz)
+        s->filesz = s->memsz;
+    }
+  }
+}
+
+int
+exec(char *path, char **argv)
+{
+  uint sz;
+  pde_t *pgdir, *oldpgdir;
+  struct proc *curproc = myproc();
+
+  curproc->nice = 20;  ///////////
+  curproc->weight = 1024;  ///////////
+
+  if(execload(curproc, path, argv, &pgdir, &sz) < 0)
+    return -1;
+
+#ifdef MMAPBASE
+  // The old image's mmap() areas go with it.
+  mmapexit(curproc);
+#endif
+
+  // Commit to the user image.
+  oldpgdir = curproc->pgdir;
+  curproc->pgdir = pgdir;
+  curproc->sz = sz;
+  curproc->ringva = 0;
+  switchuvm(curproc);
+  if(curproc->vfork)
+    vforkdone();  // oldpgdir belongs to the parent
+  else
+    freevm(oldpgdir);
+  return 0;
+}
@@ -5,21 +5,28 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
+
+// File structures come from filecache; ftable.lock
+// protects their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
 } ftable;
 
+static struct kmem_cache filecache;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kmem_cache_init(&filecache, "filecache", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
@@ -28,16 +35,12 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(&filecache)) == 0)
+    return 0;
+  f->type = FD_NONE;
+  f->ref = 1;
+  initsleeplock(&f->offlock, "fileoff");
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +72,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(&filecache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -84,9 +88,9 @@ int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     return 0;
   }
   return -1;
@@ -103,15 +107,48 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    // Readers share the inode lock. When this struct file is shared
+    // too (after fork or dup), f->off must be read and advanced by
+    // one reader at a time, so they take f->offlock first. Only its
+    // holders can dup f, so ref can not grow under us. Devices do
+    // not use the offset.
+    if(f->ref > 1 && f->ip->type != T_DEV){
+      acquiresleep(&f->offlock);
+      ilockshared(f->ip);
+      if((r = readi(f->ip, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlockshared(f->ip);
+      releasesleep(&f->offlock);
+      return r;
+    }
+    ilockshared(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     return r;
   }
   panic("fileread");
 }
 
+// The most bytes fileread(f, addr, n) can store at addr, so that
+// sys_read() faults in no more of the buffer than that. Only reads
+// of a file are limited, by its size; the size is read unlocked, so
+// a racing write can make it stale, and readi() may fault in the
+// rest itself.
+int
+filereadmax(struct file *f, int n)
+{
+  uint size, off;
+
+  if(f->type != FD_INODE || f->ip->type == T_DEV || n <= 0)
+    return n;
+  size = f->ip->size;
+  off = f->off;
+  if(off >= size)
+    return 0;
+  return size - off < n ? size - off : n;
+}
+
 //PAGEBREAK!
 // Write to file f.
 int
@@ -139,7 +176,9 @@ filewrite(struct file *f, char *addr, int n)
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+      if(f->ip->ntext > 0)
+        r = -1;  // a running program; see itext()
+      else if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
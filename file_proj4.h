@@ -8,6 +8,7 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  struct sleeplock offlock; // serializes reads that advance off
 };
 
 
@@ -16,6 +17,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int ntext;          // Processes running it as their program (itext())
+  struct inode *next; // icache hash chain
+  struct inode *lrunext, *lruprev; // icache.lru, while ref is 0
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -119,18 +120,18 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref falls to zero stays cached for a
+//   while (see below).
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid; a new cache entry
+//   starts with ip->valid clear.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -154,29 +155,50 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// In-memory inodes are allocated from inodecache when iget()
+// first looks an inode up, and kept on a hash chain keyed by
+// (dev, inum). When iput() drops the last reference to a valid
+// inode, the inode goes on icache.lru, most recent first, so path
+// walks find directories and files again without reading the disk.
+// At most NICACHE inodes wait there; the least recently used one is
+// returned to inodecache, as is any inode iget() needs memory for.
+// The icache.lock spin-lock protects the hash chains, icache.lru and
+// the ip->ref, ip->dev, ip->inum, ip->next and ip->lru* fields; one
+// must hold icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// ip->lock is a reader-writer lock: code that only reads the inode
+// (readi, stati, dirlookup) may hold it shared with ilockshared(),
+// so concurrent readers of one file do not serialize. Anything that
+// modifies the inode (writei, itrunc, dirlink, iupdate) needs ilock().
+
+#define NIHASH 61
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode lru;   // lru.lrunext is most recently used
+  int nlru;
 } icache;
 
+static struct kmem_cache inodecache;
+
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
+
+static void
+inodector(void *obj)
+{
+  initsleeplock(&((struct inode*)obj)->lock, "inode");
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.lru.lrunext = icache.lru.lruprev = &icache.lru;
+  kmem_cache_init(&inodecache, "inodecache", sizeof(struct inode), inodector);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -190,23 +212,29 @@ static struct inode* iget(uint dev, uint inum);
 //PAGEBREAK!
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if there is no memory for it.
 struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
+      if((ip = iget(dev, inum)) == 0){
+        brelse(bp);
+        return 0;
+      }
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      return ip;
     }
     brelse(bp);
   }
@@ -235,37 +263,66 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Take unreferenced ip off icache.lru.
+// Caller holds icache.lock.
+static void
+lrudel(struct inode *ip)
+{
+  ip->lrunext->lruprev = ip->lruprev;
+  ip->lruprev->lrunext = ip->lrunext;
+  icache.nlru--;
+}
+
+// Return the least recently used unreferenced inode to inodecache.
+// Caller holds icache.lock, and icache.lru is not empty.
+static void
+ievict(void)
+{
+  struct inode *ip, **pp;
+
+  ip = icache.lru.lruprev;
+  lrudel(ip);
+  for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+  kmem_cache_free(&inodecache, ip);
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if there is no memory for it.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **hp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  hp = &icache.hash[IHASH(dev, inum)];
+  for(ip = *hp; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lrudel(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  while((ip = kmem_cache_alloc(&inodecache)) == 0){
+    if(icache.nlru == 0){
+      release(&icache.lock);
+      return 0;
+    }
+    ievict();
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = *hp;
+  *hp = ip;
   release(&icache.lock);
 
   return ip;
@@ -282,6 +339,19 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Count one more process running ip as its program (delta 1),
+// or one fewer (-1). While any is, filewrite() refuses to write
+// ip, so that the pages execpage() reads in later match the ones
+// it read before. To add one, the caller holds ip's lock, shared
+// or exclusive, so no write is under way.
+void
+itext(struct inode *ip, int delta)
+{
+  acquire(&icache.lock);
+  ip->ntext += delta;
+  release(&icache.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -321,9 +391,38 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Lock the given inode for reading only.
+// Other readers may hold it at the same time.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+  if(ip->valid == 0){
+    // Loading the inode writes its fields; do that exclusively.
+    releasesleepshared(&ip->lock);
+    ilock(ip);
+    downgradesleep(&ip->lock);
+  }
+}
+
+// Drop a shared lock taken by ilockshared(). The lock does not
+// record who its readers are, so the caller must know that it holds
+// ip shared, not exclusively (see consoleread()).
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasesleepshared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the in-memory inode goes on
+// icache.lru, or back to inodecache if it is not valid.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -331,6 +430,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
@@ -347,7 +448,22 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid){
+      // No one else can lock ip without a reference.
+      ip->lrunext = icache.lru.lrunext;
+      ip->lruprev = &icache.lru;
+      icache.lru.lrunext->lruprev = ip;
+      icache.lru.lrunext = ip;
+      if(++icache.nlru > NICACHE)
+        ievict();
+    } else {
+      for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->next)
+        ;
+      *pp = ip->next;
+      kmem_cache_free(&inodecache, ip);
+    }
+  }
   release(&icache.lock);
 }
 
@@ -411,6 +527,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcinval(ip, 0, ip->size);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -435,7 +552,7 @@ itrunc(struct inode *ip)
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusive.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -448,7 +565,7 @@ stati(struct inode *ip, struct stat *st)
 
 //PAGEBREAK!
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusive.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
@@ -471,7 +588,37 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
+    pcread(ip, dst, off, m);
+  }
+  return n;
+}
+
+// Read the PGSIZE bytes of ip at off into page, like readi() but
+// reading whole blocks straight into page, a run of consecutive
+// disk blocks at a time (see breadn()). Bytes past the end of the
+// file are zeroed. off must be block-aligned and inside the file.
+// Used to fill the page cache. Returns the file bytes read, or -1.
+// Caller must hold ip->lock, shared or exclusive.
+int
+readipage(struct inode *ip, char *page, uint off)
+{
+  uint n, tot, bn, run;
+
+  if(ip->type == T_DEV || off % BSIZE || off >= ip->size)
+    return -1;
+  n = ip->size - off;
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  for(tot = 0; tot < n; tot += run*BSIZE){
+    bn = bmap(ip, (off + tot)/BSIZE);
+    for(run = 1; tot + run*BSIZE < n; run++)
+      if(bmap(ip, (off + tot)/BSIZE + run) != bn + run)
+        break;
+    breadn(ip->dev, bn, run, page + tot);
   }
+  memset(page + n, 0, PGSIZE - n);
+  pcread(ip, page, off, n);
   return n;
 }
 
@@ -499,6 +646,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
+    pcwrite(ip, (char*)bp->data + off%BSIZE, off, m);
     log_write(bp);
     brelse(bp);
   }
@@ -519,12 +667,13 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
-// If found, set *poff to byte offset of entry.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+// Find name in directory dp and return its inode number, setting
+// *poff to the byte offset of the entry, or return 0.
+// Caller must hold dp->lock, shared or exclusive.
+static uint
+direntry(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off;
   struct dirent de;
 
   if(dp->type != T_DIR)
@@ -539,27 +688,38 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       // entry matches path element
       if(poff)
         *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+      return de.inum;
     }
   }
 
   return 0;
 }
 
+// Look for a directory entry in a directory.
+// If found, set *poff to byte offset of entry.
+// Returns 0 if there is none, or no memory for its inode.
+// Caller must hold dp->lock, shared or exclusive.
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint inum;
+
+  if((inum = direntry(dp, name, poff)) == 0)
+    return 0;
+  return iget(dp->dev, inum);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
+// Caller must hold dp->lock exclusively.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
   struct dirent de;
-  struct inode *ip;
 
   // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
+  if(direntry(dp, name, 0) != 0)
     return -1;
-  }
 
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
@@ -626,27 +786,31 @@ namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
-  if(*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
-  else
+  if(*path == '/'){
+    if((ip = iget(ROOTDEV, ROOTINO)) == 0)
+      return 0;
+  } else
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
     if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
-    iunlockput(ip);
+    iunlockshared(ip);
+    iput(ip);
     ip = next;
   }
   if(nameiparent){
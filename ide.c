@@ -70,30 +70,45 @@ ideinit(void)
 }
 
 // Start the request for b.  Caller must hold idelock.
+// A direct request (b->addr set) moves b->nblock blocks to or from
+// b->addr with one command, a sector per interrupt.
 static void
 idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  int nblock = b->addr ? b->nblock : 1;
+  if(b->blockno >= FSSIZE + SWAPBLOCKS ||
+     nblock > FSSIZE + SWAPBLOCKS - b->blockno)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
+  int nsect = nblock * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7) panic("idestart");
+  if(b->addr){
+    if(nsect > 255)
+      panic("idestart: request too big");
+    read_cmd = IDE_CMD_READ;
+    write_cmd = IDE_CMD_WRITE;
+    b->nsect = 0;
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    if(b->addr)
+      outsl(0x1f0, b->addr, SECTOR_SIZE/4);
+    else
+      outsl(0x1f0, b->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -112,11 +127,24 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+  if(b->addr){
+    // Direct request: one sector has been transferred.
+    if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+      insl(0x1f0, b->addr + b->nsect*SECTOR_SIZE, SECTOR_SIZE/4);
+    if(++b->nsect < b->nblock * (BSIZE/SECTOR_SIZE)){
+      if(b->flags & B_DIRTY){
+        idewait(0);
+        outsl(0x1f0, b->addr + b->nsect*SECTOR_SIZE, SECTOR_SIZE/4);
+      }
+      release(&idelock);
+      return;
+    }
+  } else if(!(b->flags & B_DIRTY) && idewait(1) >= 0){
+    // Read data if needed.
     insl(0x1f0, b->data, BSIZE/4);
+  }
+  idequeue = b->qnext;
 
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
@@ -0,0 +1,45 @@
+// Batched I/O ring shared between a process and the kernel.
+//
+// The process places one page-aligned page of its own memory
+// laid out as struct ioring and registers it with ringsetup().
+// It queues requests by filling sq[sqtail % IORING_NSQ] and then
+// incrementing sqtail; ringenter() makes the kernel consume
+// requests from sqhead up to sqtail and post one completion per
+// request at cq[cqtail % IORING_NCQ]. The requests run one after
+// another inside ringenter(), so when it returns their completions
+// have all been posted. The process reaps
+// completions from cqhead and advances it. Each index is only
+// ever written by one side.
+
+#define IORING_NSQ  128
+#define IORING_NCQ  128
+
+// Operations
+#define IORING_OP_NOP    0
+#define IORING_OP_READ   1   // fileread(fd, addr, len)
+#define IORING_OP_WRITE  2   // filewrite(fd, addr, len)
+#define IORING_OP_OPEN   3   // open(path at addr, omode len)
+#define IORING_OP_CLOSE  4   // close(fd)
+#define IORING_OP_FSTAT  5   // fstat(fd, struct stat at addr)
+
+struct iosqe {
+  int op;
+  int fd;
+  uint addr;
+  int len;
+  uint data;          // copied to the completion untouched
+};
+
+struct iocqe {
+  uint data;
+  int res;            // what the equivalent system call returns
+};
+
+struct ioring {
+  volatile uint sqhead;  // written by the kernel
+  volatile uint sqtail;  // written by the process
+  volatile uint cqhead;  // written by the process
+  volatile uint cqtail;  // written by the kernel
+  struct iosqe sq[IORING_NSQ];
+  struct iocqe cq[IORING_NCQ];
+};
@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or physically
+// contiguous blocks of 2^order pages.
 
 #include "types.h"
 #include "defs.h"
@@ -13,26 +14,89 @@ void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define NPAGE      (PHYSTOP/PGSIZE)
+#define KBATCH     16  // pages moved between a CPU cache and kmem at once
+#define KCACHEMAX  (4*KBATCH)  // most pages a CPU cache holds
+#define ZPOOLMAX   64  // most pre-zeroed pages kept for kalloc_zeroed()
+
+// pginfo[pfn] for the first page of a free block
+#define PG_FREE    0x80
+#define PG_ORDER   0x0f
+
+// Free blocks are kept on doubly linked lists so that a block
+// can be taken off its list when its buddy is freed.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+// Binary buddy allocator over physical pages. A block of order k
+// is 2^k pages starting at a page number that is a multiple of 2^k;
+// its buddy is the block whose page number differs only in bit k.
+// Freeing a block merges it with its buddy while the buddy is free
+// and of the same order.
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run freelist[MAXORDER+1];  // list heads
+  int nfree[MAXORDER+1];            // free blocks of each order
 } kmem;
 
+static uchar pginfo[NPAGE];
+
+// Extra references to an allocated page, beyond the one kalloc()
+// returned, taken by kref() when the page is shared (e.g. between
+// a parent and child after a copy-on-write fork). kfree() drops a
+// reference and only frees the page when none are left. Changes
+// are made under kmem.lock; pages with no extra references skip it.
+static ushort pgref[NPAGE];
+
+// Per-CPU caches of free pages in front of the order-0 buddy list.
+// A CPU normally only touches its own cache, with interrupts off, so
+// its lock is uncontended, and kalloc() and kfree() take kmem.lock
+// only to move a batch of KBATCH pages when the cache runs empty or
+// grows past KCACHEMAX. Up to KCACHEMAX pages per CPU can sit unused
+// in a cache while kmem is empty; an allocation that finds kmem empty
+// takes them back with kdrain() before it fails.
+struct kcache {
+  struct spinlock lock;  // taken by other CPUs only in kdrain()
+  struct run *freelist;
+  int nfree;
+};
+static struct kcache kcache[NCPU];
+
+// Pages zeroed ahead of time by idle CPUs (see kzerofill()), so
+// kalloc_zeroed() need not clear a page on the fault path. A pooled
+// page is all zero except for the struct run link at its start.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} zpool;
+
+// A page of zeros that read faults on untouched anonymous memory
+// map copy-on-write (see cowpage()). It is never freed, and is not
+// reference counted: kref() and kfree() ignore it.
+char *zeropage;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// The CPU caches are only used once kinit2() has set use_lock.
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&zpool.lock, "zpool");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   kmem.use_lock = 0;
+  for(i = 0; i <= MAXORDER; i++)
+    kmem.freelist[i].next = kmem.freelist[i].prev = &kmem.freelist[i];
   freerange(vstart, vend);
 }
 
@@ -41,6 +105,8 @@ kinit2(void *vstart, void *vend)
 {
   freerange(vstart, vend);
   kmem.use_lock = 1;
+  if((zeropage = kalloc_zeroed()) == 0)
+    panic("kinit2");
 }
 
 void
@@ -51,6 +117,125 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+static void
+listadd(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void
+listdel(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+// Put the block at page pfn back, merging with free buddies.
+// Caller holds kmem.lock (or is still single-threaded at boot).
+static void
+buddyfree(uint pfn, int order)
+{
+  uint b;
+
+  for(; order < MAXORDER; order++){
+    b = pfn ^ (1 << order);
+    if(b + (1 << order) > NPAGE || pginfo[b] != (PG_FREE | order))
+      break;
+    listdel((struct run*)P2V(b * PGSIZE));
+    kmem.nfree[order]--;
+    pginfo[b] = 0;
+    if(b < pfn)
+      pfn = b;
+  }
+  pginfo[pfn] = PG_FREE | order;
+  listadd(&kmem.freelist[order], (struct run*)P2V(pfn * PGSIZE));
+  kmem.nfree[order]++;
+}
+
+// Take a block of 2^order pages, splitting a larger one if needed.
+// Caller holds kmem.lock. Returns 0 if no block is big enough.
+static char*
+buddyalloc(int order)
+{
+  struct run *r;
+  uint pfn;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.nfree[k])
+      break;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.freelist[k].next;
+  listdel(r);
+  kmem.nfree[k]--;
+  pfn = V2P(r) / PGSIZE;
+  pginfo[pfn] = 0;
+  // Return the unused upper halves.
+  while(k > order){
+    k--;
+    pginfo[pfn + (1 << k)] = PG_FREE | k;
+    listadd(&kmem.freelist[k], (struct run*)P2V((pfn + (1 << k)) * PGSIZE));
+    kmem.nfree[k]++;
+  }
+  return (char*)r;
+}
+
+// Take a page from zpool, or return 0 if it is empty.
+static struct run*
+zpoolget(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  if((r = zpool.freelist) != 0){
+    zpool.freelist = r->next;
+    zpool.nfree--;
+  }
+  release(&zpool.lock);
+  return r;
+}
+
+// Drop an extra reference to page v, if it has one.
+// Returns 1 if it did, 0 if the caller holds the last reference.
+static int
+kunref(char *v)
+{
+  int r;
+
+  acquire(&kmem.lock);
+  r = pgref[V2P(v) / PGSIZE] > 0;
+  if(r)
+    pgref[V2P(v) / PGSIZE]--;
+  release(&kmem.lock);
+  return r;
+}
+
+// Take another reference to the kalloc()ed page v;
+// each reference is dropped with kfree().
+void
+kref(char *v)
+{
+  if(v == zeropage)
+    return;
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+  acquire(&kmem.lock);
+  pgref[V2P(v) / PGSIZE]++;
+  release(&kmem.lock);
+}
+
+// Number of references to the allocated page v.
+int
+krefcount(char *v)
+{
+  return pgref[V2P(v) / PGSIZE] + 1;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -60,20 +245,74 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
+  int i;
 
+  if(v == zeropage)
+    return;
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(pgref[V2P(v) / PGSIZE] && kunref(v))
+    return;
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
+  if(!kmem.use_lock){
+    buddyfree(V2P(v) / PGSIZE, 0);
+    return;
+  }
+
+  pushcli();
+  c = &kcache[cpuid()];
+  acquire(&c->lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->nfree > KCACHEMAX){
+    // Give a batch back to the buddy allocator.
+    acquire(&kmem.lock);
+    for(i = 0; i < KBATCH; i++){
+      r = c->freelist;
+      c->freelist = r->next;
+      c->nfree--;
+      buddyfree(V2P(r) / PGSIZE, 0);
+    }
     release(&kmem.lock);
+  }
+  release(&c->lock);
+  popcli();
+}
+
+// Move the pages in every CPU's cache back to the buddy allocator,
+// for an allocation that found it empty. Returns the number of
+// pages moved. Caller holds no kcache lock.
+static int
+kdrain(void)
+{
+  struct kcache *c;
+  struct run *r;
+  int n;
+
+  n = 0;
+  for(c = kcache; c < &kcache[NCPU]; c++){
+    if(c->nfree == 0)
+      continue;
+    acquire(&c->lock);
+    acquire(&kmem.lock);
+    while((r = c->freelist) != 0){
+      c->freelist = r->next;
+      c->nfree--;
+      buddyfree(V2P(r) / PGSIZE, 0);
+      n++;
+    }
+    release(&kmem.lock);
+    release(&c->lock);
+  }
+  return n;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +322,170 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
 
-  if(kmem.use_lock)
+  if(!kmem.use_lock)
+    return buddyalloc(0);
+
+  do {
+    pushcli();
+    c = &kcache[cpuid()];
+    acquire(&c->lock);
+    if(c->freelist == 0){
+      // Refill with a batch from the buddy allocator.
+      acquire(&kmem.lock);
+      while(c->nfree < KBATCH && (r = (struct run*)buddyalloc(0)) != 0){
+        r->next = c->freelist;
+        c->freelist = r;
+        c->nfree++;
+      }
+      release(&kmem.lock);
+    }
+    r = c->freelist;
+    if(r){
+      c->freelist = r->next;
+      c->nfree--;
+    }
+    release(&c->lock);
+    popcli();
+  } while(r == 0 && kdrain() > 0);  // other CPUs' caches had some
+  if(r == 0)
+    r = zpoolget();  // last resort: a pre-zeroed page
+  return (char*)r;
+}
+
+// Allocate one page of zeroed physical memory.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if(kmem.use_lock && (r = zpoolget()) != 0){
+    r->next = 0;
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
+  return (char*)r;
+}
+
+// Allocate up to n pages into pages[], taking kmem.lock once
+// for the lot rather than once per batch of the CPU cache.
+// Returns the number allocated.
+int
+kalloc_batch(char **pages, int n)
+{
+  int i;
+
+  i = 0;
+  if(kmem.use_lock){
     acquire(&kmem.lock);
-  r = kmem.freelist;
+    for(; i < n && (pages[i] = buddyalloc(0)) != 0; i++)
+      ;
+    release(&kmem.lock);
+  }
+  for(; i < n && (pages[i] = kalloc()) != 0; i++)
+    ;
+  return i;
+}
+
+// Zero one free page into zpool, if it is not full.
+// Called by the scheduler on a CPU with nothing to run.
+void
+kzerofill(void)
+{
+  struct run *r;
+
+  if(zpool.nfree >= ZPOOLMAX || (r = (struct run*)kalloc()) == 0)
+    return;
+  memset(r, 0, PGSIZE);
+  acquire(&zpool.lock);
+  if(zpool.nfree < ZPOOLMAX){
+    r->next = zpool.freelist;
+    zpool.freelist = r;
+    zpool.nfree++;
+    r = 0;
+  }
+  release(&zpool.lock);
   if(r)
-    kmem.freelist = r->next;
+    kfree((char*)r);
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if no such block is free.
+char*
+kalloc_pages(int order)
+{
+  char *v;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(!kmem.use_lock)
+    return buddyalloc(order);
+  do {
+    acquire(&kmem.lock);
+    v = buddyalloc(order);
+    release(&kmem.lock);
+  } while(v == 0 && kdrain() > 0);  // cached pages may complete a block
+  return v;
+}
+
+// Free a block returned by kalloc_pages(order), or drop one
+// reference that kref() took on it.
+void
+kfree_pages(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(order < 0 || order > MAXORDER || (uint)v % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  // Shared blocks (MAP_HUGE) are counted on their first page.
+  if(pgref[V2P(v) / PGSIZE] && kunref(v))
+    return;
+
+#ifdef KALLOC_JUNK
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  buddyfree(V2P(v) / PGSIZE, order);
   if(kmem.use_lock)
     release(&kmem.lock);
-  return (char*)r;
 }
 
+// Copy the number of free blocks of each order into
+// counts[0..MAXORDER]. Pages in CPU caches and zpool count
+// as order 0.
+void
+kfreecounts(int *counts)
+{
+  int i;
+
+  for(i = 0; i <= MAXORDER; i++)
+    counts[i] = kmem.nfree[i];
+  for(i = 0; i < NCPU; i++)
+    counts[0] += kcache[i].nfree;
+  counts[0] += zpool.nfree;
+}
+
+// Number of free pages.
+int
+freemem(void)
+{
+  int counts[MAXORDER+1];
+  int i, n;
+
+  kfreecounts(counts);
+  n = 0;
+  for(i = 0; i <= MAXORDER; i++)
+    n += counts[i] << i;
+  return n;
+}
@@ -28,8 +28,11 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
+  vdsoinit();      // user-readable kernel data
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipe cache
+  pcacheinit();    // file page cache
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
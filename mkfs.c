@@ -109,6 +109,8 @@ main(int argc, char *argv[])
 
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
+  if(SWAPBLOCKS > 0)
+    wsect(FSSIZE + SWAPBLOCKS - 1, zeroes);  // swap area follows
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
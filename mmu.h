@@ -2,6 +2,7 @@
 // x86 memory management unit (MMU).
 
 // Eflags register
+#define FL_TF           0x00000100      // Trap Flag
 #define FL_IF           0x00000200      // Interrupt Enable
 
 // Control Register flags
@@ -10,6 +11,17 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
+
+// CPUID leaf 1 %edx feature bits
+#define CPUID_TSC       0x00000010      // Time stamp counter supported
+#define CPUID_PGE       0x00002000      // Global pages supported
+#define CPUID_SEP       0x00000800      // SYSENTER/SYSEXIT supported
+
+// Model specific registers
+#define MSR_SYSENTER_CS  0x174          // CS for SYSENTER (SS is CS+8)
+#define MSR_SYSENTER_ESP 0x175          // kernel stack for SYSENTER
+#define MSR_SYSENTER_EIP 0x176          // kernel entry point for SYSENTER
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -83,6 +95,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define BIGPGSIZE       (PGSIZE*NPTENTRIES)  // bytes mapped by a PTE_PS page
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
@@ -94,7 +107,18 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global: kept in the TLB across CR3 loads
+#define PTE_COW         0x200   // Copy-on-write (available to software)
+#define PTE_SWAP        0x400   // Not present, swapped out to the slot
+                                // in the address bits (software)
+
+// Page fault error code bits
+#define FEC_PR          0x1     // Page was present
+#define FEC_WR          0x2     // Fault was a write
+#define FEC_U           0x4     // Fault happened in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
@@ -0,0 +1,294 @@
+// Page cache: file pages kept in memory, keyed by (inode, offset),
+// so that processes running the same program share its text and
+// data instead of each reading its own copy.
+//
+// A cached page is an ordinary kalloc() page; the cache holds one
+// reference and every mapping of it another (see kref()). Private
+// mappings (program text and data, MAP_PRIVATE) map it copy-on-
+// write. Writing or truncating the file drops the affected pages
+// from the cache; private mappers keep the old contents.
+//
+// A page that some mmap(MAP_SHARED) mapping uses (nshared > 0) is
+// instead the current contents of that part of the file: mappers
+// write it directly, writei() copies new data into it as well as
+// to disk, and readi() reads through it (pcread()). Mappers write
+// dirty pages back to the file when they unmap them.
+//
+// Pages are filled and dropped with the inode locked (readers
+// shared, writers exclusive), so a page read before a write can
+// not be entered into the cache after the write dropped it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "slab.h"
+
+#define NPCHASH  61
+#define NPCPAGE  256  // most pages the cache holds
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;              // file offset of the page's first byte
+  char *page;
+  int nshared;           // MAP_SHARED mappings of the page
+  struct pcpage *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage *hash[NPCHASH];  // chained by (dev, inum)
+  int n;
+  int nshared;                   // sum of the pages' nshared
+} pcache;
+
+static struct kmem_cache pcpagecache;
+
+#define PCHASH(dev, inum) (((dev)*31 + (inum)) % NPCHASH)
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  kmem_cache_init(&pcpagecache, "pcpage", sizeof(struct pcpage), 0);
+}
+
+// Find the cached page of ip at off. Caller holds pcache.lock.
+static struct pcpage*
+pclookup(struct inode *ip, uint off)
+{
+  struct pcpage *e;
+
+  for(e = pcache.hash[PCHASH(ip->dev, ip->inum)]; e; e = e->next)
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == off)
+      return e;
+  return 0;
+}
+
+// Unlink *pp from its chain and free it. Caller holds pcache.lock.
+static void
+pcdrop(struct pcpage **pp)
+{
+  struct pcpage *e = *pp;
+
+  *pp = e->next;
+  kfree(e->page);
+  kmem_cache_free(&pcpagecache, e);
+  pcache.n--;
+}
+
+// Make room by dropping a page nobody maps.
+// Caller holds pcache.lock.
+static int
+pcevict(void)
+{
+  struct pcpage **pp;
+  int h;
+
+  for(h = 0; h < NPCHASH; h++)
+    for(pp = &pcache.hash[h]; *pp; pp = &(*pp)->next)
+      if(krefcount((*pp)->page) == 1){
+        pcdrop(pp);
+        return 0;
+      }
+  return -1;
+}
+
+// Return the PGSIZE bytes of ip at off in a page the caller gets a
+// reference to; bytes past the end of the file are zero. Only
+// MAP_SHARED mappers (see pcshare()) may write the page. Reads the
+// file on a miss. Returns 0 if off is not inside the file or the
+// page cannot be read.
+// Caller holds ip's lock, shared or exclusive.
+char*
+pcget(struct inode *ip, uint off)
+{
+  struct pcpage *e;
+  char *mem;
+  uint n;
+  int h;
+
+  if(off >= ip->size || off + PGSIZE < off)
+    return 0;
+  n = ip->size - off;
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip, off)) != 0){
+    kref(e->page);
+    release(&pcache.lock);
+    return e->page;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  if(off % BSIZE == 0){
+    if(readipage(ip, mem, off) != n){
+      kfree(mem);
+      return 0;
+    }
+  } else {
+    if(readi(ip, mem, off, n) != n){
+      kfree(mem);
+      return 0;
+    }
+    memset(mem + n, 0, PGSIZE - n);
+  }
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip, off)) != 0){
+    // Another reader filled it meanwhile.
+    kref(e->page);
+    release(&pcache.lock);
+    kfree(mem);
+    return e->page;
+  }
+  if((pcache.n < NPCPAGE || pcevict() == 0) &&
+     (e = kmem_cache_alloc(&pcpagecache)) != 0){
+    e->dev = ip->dev;
+    e->inum = ip->inum;
+    e->off = off;
+    e->page = mem;
+    e->nshared = 0;
+    h = PCHASH(ip->dev, ip->inum);
+    e->next = pcache.hash[h];
+    pcache.hash[h] = e;
+    pcache.n++;
+    kref(mem);
+  }
+  // Otherwise the cache is full of pages in use; mem stays private.
+  release(&pcache.lock);
+  return mem;
+}
+
+// Like pcget(), but only return a page that is already cached.
+char*
+pcpeek(struct inode *ip, uint off)
+{
+  struct pcpage *e;
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip, off)) != 0)
+    kref(e->page);
+  release(&pcache.lock);
+  return e ? e->page : 0;
+}
+
+// Count a MAP_SHARED mapping of page, which pcget() returned for
+// ip at off, coming (delta 1) or going (delta -1). Returns -1 if
+// page did not go into the cache. A mapping holds a reference to
+// its page, so once counted the page stays cached.
+int
+pcshare(struct inode *ip, uint off, char *page, int delta)
+{
+  struct pcpage *e;
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip, off)) == 0 || e->page != page){
+    release(&pcache.lock);
+    return -1;
+  }
+  e->nshared += delta;
+  pcache.nshared += delta;
+  release(&pcache.lock);
+  return 0;
+}
+
+// writei() has written n bytes from src to ip at off: copy them
+// into the shared pages they overlap and drop the other pages.
+// Caller holds ip's lock exclusively.
+void
+pcwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct pcpage **pp, *e;
+  uint lo, hi;
+
+  acquire(&pcache.lock);
+  pp = &pcache.hash[PCHASH(ip->dev, ip->inum)];
+  while((e = *pp) != 0){
+    if(e->dev != ip->dev || e->inum != ip->inum ||
+       e->off >= off + n || off >= e->off + PGSIZE){
+      pp = &e->next;
+      continue;
+    }
+    if(e->nshared == 0){
+      pcdrop(pp);
+      continue;
+    }
+    lo = off > e->off ? off : e->off;
+    hi = off + n < e->off + PGSIZE ? off + n : e->off + PGSIZE;
+    memmove(e->page + (lo - e->off), src + (lo - off), hi - lo);
+    pp = &e->next;
+  }
+  release(&pcache.lock);
+}
+
+// readi() has read n bytes of ip at off into dst from disk: replace
+// any that a shared page holds, which may be newer. dst may be user
+// memory, which can fault, so the copying is done without
+// pcache.lock, holding a reference to one page at a time; the pages
+// are taken in file order.
+// Caller holds ip's lock, shared or exclusive.
+void
+pcread(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct pcpage *e;
+  char *page;
+  uint lo, hi, poff, next;
+  int first;
+
+  if(pcache.nshared == 0)
+    return;
+  for(first = 1, poff = 0; ; first = 0){
+    page = 0;
+    next = 0;
+    acquire(&pcache.lock);
+    for(e = pcache.hash[PCHASH(ip->dev, ip->inum)]; e; e = e->next){
+      if(e->nshared == 0 || e->dev != ip->dev || e->inum != ip->inum ||
+         e->off >= off + n || off >= e->off + PGSIZE)
+        continue;
+      if((!first && e->off <= poff) || (page && e->off >= next))
+        continue;
+      page = e->page;
+      next = e->off;
+    }
+    if(page)
+      kref(page);
+    release(&pcache.lock);
+    if(page == 0)
+      break;
+    poff = next;
+    lo = off > poff ? off : poff;
+    hi = off + n < poff + PGSIZE ? off + n : poff + PGSIZE;
+    memmove(dst + (lo - off), page + (lo - poff), hi - lo);
+    kfree(page);
+  }
+}
+
+// Drop ip's cached pages that overlap [off, off+n), for itrunc().
+// Caller holds ip's lock exclusively.
+void
+pcinval(struct inode *ip, uint off, uint n)
+{
+  struct pcpage **pp;
+
+  if(n == 0)
+    return;
+  acquire(&pcache.lock);
+  pp = &pcache.hash[PCHASH(ip->dev, ip->inum)];
+  while(*pp){
+    if((*pp)->dev == ip->dev && (*pp)->inum == ip->inum &&
+       (*pp)->off < off + n && off < (*pp)->off + PGSIZE)
+      pcdrop(pp);
+    else
+      pp = &(*pp)->next;
+  }
+  release(&pcache.lock);
+}
@@ -2,8 +2,6 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -11,4 +9,16 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define SWAPBLOCKS      0  // no swap area; Project 5 has one (param_project5.h)
 
+#define NICACHE      50  // unreferenced inodes kept in memory
+#define NSYSSTAT     32  // system call numbers tracked by sysstat
+#define MAXORDER     10  // largest kalloc_pages() block: 2^10 pages (4MB)
+
+// mmap() protection and flags (Project 4)
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+#define MAP_POPULATE   0x2
+#define MAP_SHARED     0x4  // writes reach the file and other mappers
+#define MAP_HUGE       0x8  // anonymous, backed by 4MB pages
@@ -5,6 +5,7 @@
 #include "mmu.h"
 #include "x86.h"
 #include "proc.h"
+#include "vdso.h"
 #include "spinlock.h"
 #include "math.h"
 #include "biguint.h"
@@ -164,6 +165,18 @@ found:
     p->state = UNUSED;
     return 0;
   }
+  if((p->vdso = kalloc()) == 0){
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return 0;
+  }
+  vdsoprocinit(p->vdso, p->pid);
+  p->ringva = 0;
+  p->vfork = 0;
+  p->exe = 0;
+  p->nseg = 0;
+  memset(p->syscount, 0, sizeof(p->syscount));
   sp = p->kstack + KSTACKSIZE;
 
   // Leave room for trap frame.
@@ -198,6 +211,8 @@ userinit(void)
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  if(mapvdso(p->pgdir, p->vdso) < 0)
+    panic("userinit: out of memory?");
   p->sz = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
@@ -232,17 +247,35 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Pages are allocated on first touch; see lazypage().
+    if(sz + n < sz || sz + n > VDSOBASE)
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
+    exectrim(curproc, sz);
   }
   curproc->sz = sz;
   switchuvm(curproc);
   return 0;
 }
 
+// Start np's scheduling state from its parent's virtual
+// runtime. np->nice must be set. Caller holds ptable.lock.
+static void
+childsched(struct proc *np, struct proc *parent)
+{
+  np->vruntime = parent->vruntime;
+  np->runtime = 0;
+  np->weight = weight[np->nice];
+  int total_weight = 0;
+  for(struct proc *p = ptable.proc; p<&ptable.proc[NPROC]; p++) {
+    if (p->state == RUNNABLE){
+      total_weight += weight[p->nice];}}
+  np->timeslice = 10000*(weight[np->nice] / (total_weight == 0 ? 1 : total_weight));
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -259,9 +292,15 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0 ||
+     mapvdso(np->pgdir, np->vdso) < 0){
+    if(np->pgdir)
+      freevm(np->pgdir);
+    np->pgdir = 0;
     kfree(np->kstack);
     np->kstack = 0;
+    kfree(np->vdso);
+    np->vdso = 0;
     np->state = UNUSED;
     return -1;
   }
@@ -276,6 +315,7 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  execdup(np, curproc);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -287,19 +327,113 @@ fork(void)
 
   // MINE. Set the nice value for the child process
   np->nice = curproc->nice;
-  np->vruntime = curproc->vruntime;
-  np->runtime = 0;
-  np->weight = weight[np->nice];
-  int total_weight = 0;
-  for(struct proc *p = ptable.proc; p<&ptable.proc[NPROC]; p++) {
-    if (p->state == RUNNABLE){
-      total_weight += weight[p->nice];}}
-  np->timeslice = 10000*(weight[np->nice] / (total_weight == 0 ? 1 : total_weight));
+  childsched(np, curproc);
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Like fork(), but the child borrows the parent's address space
+// instead of copying it, and the parent sleeps until the child
+// calls exec() or exit(). The child must not return from the
+// function that called vfork() or change memory the parent is
+// using. Until then the child also reads the parent's vdso page,
+// so that page shows the child's pid while the parent sleeps.
+int
+vfork(void)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  np->vfork = 1;
+  np->parent = curproc;
+  *np->tf = *curproc->tf;
+
+  // Clear %eax so that vfork returns 0 in the child.
+  np->tf->eax = 0;
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+  execdup(np, curproc);
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  pid = np->pid;
+  vdsoprocinit(curproc->vdso, pid);
+
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  np->nice = curproc->nice;
+  childsched(np, curproc);
+  while(np->vfork)
+    sleep(curproc, &ptable.lock);
+  release(&ptable.lock);
+  return pid;
+}
 
+// Called by a vfork() child that has switched to its own
+// address space: let the parent run again.
+void
+vforkdone(void)
+{
+  struct proc *curproc = myproc();
 
+  acquire(&ptable.lock);
+  curproc->vfork = 0;
+  vdsoprocinit(curproc->parent->vdso, curproc->parent->pid);
+  wakeup1(curproc->parent);
   release(&ptable.lock);
+}
+
+// Start a child running the program at path, without copying
+// the current address space the way fork() would. ofile is the
+// child's file table; spawn() takes over its references, even
+// when it fails.
+int
+spawn(char *path, char **argv, struct file **ofile)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
 
+  if((np = allocproc()) == 0)
+    goto bad;
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  np->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  np->tf->es = np->tf->ds;
+  np->tf->ss = np->tf->ds;
+  np->tf->eflags = FL_IF;
+  if(execload(np, path, argv, &np->pgdir, &np->sz) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    kfree(np->vdso);
+    np->vdso = 0;
+    np->state = UNUSED;
+    goto bad;
+  }
+  np->parent = curproc;
+  for(i = 0; i < NOFILE; i++)
+    np->ofile[i] = ofile[i];
+  np->cwd = idup(curproc->cwd);
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  childsched(np, curproc);
+  release(&ptable.lock);
   return pid;
+
+bad:
+  for(i = 0; i < NOFILE; i++)
+    if(ofile[i])
+      fileclose(ofile[i]);
+  return -1;
 }
 
 // Exit the current process.  Does not return.
@@ -325,12 +459,24 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe){
+    itext(curproc->exe, -1);
+    iput(curproc->exe);
+  }
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
-  // Parent might be sleeping in wait().
+  // A vfork() child gives the address space back to its parent.
+  if(curproc->vfork){
+    curproc->vfork = 0;
+    curproc->pgdir = 0;
+    vdsoprocinit(curproc->parent->vdso, curproc->parent->pid);
+  }
+
+  // Parent might be sleeping in wait() or vfork().
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
@@ -370,7 +516,11 @@ wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
+        kfree(p->vdso);
+        p->vdso = 0;
+        if(p->pgdir)
+          freevm(p->pgdir);
+        p->pgdir = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -454,6 +604,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 
+    // Nothing to run: use the time to zero pages for kalloc_zeroed().
+    if(minp == 0)
+      kzerofill();
   }
 }
 
@@ -612,6 +765,36 @@ kill(int pid)
   return -1;
 }
 
+// Copy the system call counts of the process with the given pid.
+int
+getsyscount(int pid, uint *counts)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      memmove(counts, p->syscount, sizeof(p->syscount));
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Clear every process's system call counts.
+void
+resetsyscount(void)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    memset(p->syscount, 0, sizeof(p->syscount));
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
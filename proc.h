@@ -9,6 +9,8 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // User page table in cr3, or 0
+  volatile uint tlbstale;      // Shootdown pending, see tlbflush()
 };
 
 extern struct cpu cpus[NCPU];
@@ -35,11 +37,29 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A loadable ELF segment of the running program. Its pages are
+// read from the executable on first touch; see execpage().
+#define NEXECSEG 4
+
+struct execseg {
+  uint va;                     // Page-aligned start
+  uint off;                    // Offset of va in the executable
+  uint filesz;                 // Bytes backed by the file; the rest is zero
+  uint memsz;
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
+  char *vdso;                  // Private vdso page, mapped at VDSOPROC
+  uint ringva;                 // User address of registered I/O ring, or 0
+  int vfork;                   // Borrowing the parent's address space (vfork())
+  struct inode *exe;           // Executable the image is paged in from
+  int nseg;
+  struct execseg seg[NEXECSEG];
+  uint syscount[NSYSSTAT];     // System calls made, while sysstat is on
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
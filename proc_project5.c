@@ -5,6 +5,7 @@
 #include "mmu.h"
 #include "x86.h"
 #include "proc.h"
+#include "vdso.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
@@ -15,8 +16,6 @@ struct {
   struct proc proc[NPROC];
 } ptable;
 
-int first = 1;
-
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -29,6 +28,8 @@ void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  mmapinit();
+  swapinit();
 }
 
 // Must be called with interrupts disabled
@@ -101,6 +102,21 @@ found:
     p->state = UNUSED;
     return 0;
   }
+  if((p->vdso = kalloc()) == 0){
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return 0;
+  }
+  vdsoprocinit(p->vdso, p->pid);
+  p->ringva = 0;
+  p->vfork = 0;
+  p->exe = 0;
+  p->nseg = 0;
+  p->mmaps = 0;
+  p->mmaphint = 0;
+  p->npin = 0;
+  memset(p->syscount, 0, sizeof(p->syscount));
   sp = p->kstack + KSTACKSIZE;
 
   // Leave room for trap frame.
@@ -134,6 +150,8 @@ userinit(void)
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  if(mapvdso(p->pgdir, p->vdso) < 0)
+    panic("userinit: out of memory?");
   p->sz = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
@@ -168,11 +186,14 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Pages are allocated on first touch; see lazypage().
+    if(sz + n < sz || sz + n > VDSOBASE || mmapoverlap(curproc, sz, sz + n))
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
+    exectrim(curproc, sz);
   }
   curproc->sz = sz;
   switchuvm(curproc);
@@ -195,9 +216,17 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0 ||
+     mapvdso(np->pgdir, np->vdso) < 0 ||
+     mmapdup(curproc, np) < 0){
+    mmapexit(np);
+    if(np->pgdir)
+      freevm(np->pgdir);
+    np->pgdir = 0;
     kfree(np->kstack);
     np->kstack = 0;
+    kfree(np->vdso);
+    np->vdso = 0;
     np->state = UNUSED;
     return -1;
   }
@@ -211,82 +240,116 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  execdup(np, curproc);
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
   pid = np->pid;
 
-  if (first){
-    for (int k=0; k<64; k++){
-      mmap_areas[k].p = 0;
-      mmap_areas[k].addr = 0;
-      mmap_areas[k].offset= 0;
-      mmap_areas[k].f = 0;
-      mmap_areas[k].flags = 0;
-      mmap_areas[k].length = 0;
-      mmap_areas[k].prot = 0;
-    }
-    first = 0;
-  }
+  acquire(&ptable.lock);
 
-  int j;
-  int empty_index=0;
-  for (j=0; j < 64; j++){  
-    if (mmap_areas[j].p == curproc) {
-      empty_index = j+1;
-      break;
-    }
-  }
-  mmap_areas[empty_index] = mmap_areas[j];
-  mmap_areas[empty_index].p = np;
-
-  struct file *f = mmap_areas[empty_index].f;
-  uint addr = mmap_areas[empty_index].addr;
-  int length = mmap_areas[empty_index].length;
-  int offset = mmap_areas[empty_index].offset;
-  int prot = mmap_areas[empty_index].prot;
-  int flags = mmap_areas[empty_index].flags;
-  struct proc *p = mmap_areas[empty_index].p;
-  char *mem = 0;
-
-  int cur;
-  if (flags == 2 || flags == 0){
-    uint original = f->off;
-    f->off = offset;
-    //int r;
-    for(cur=0; cur<length; cur+=PGSIZE){
-      mem = kalloc();
-      if (!mem) 
-        return 0;
-      memset(mem, 0, PGSIZE);
-      int org = f->off;
-      f->off = mmap_areas[j].offset;
-      fileread(f, mem, PGSIZE);
-      f->off = org;
-      if(mappages(p->pgdir, (void*)(addr + cur), PGSIZE, V2P(mem), prot|PTE_U)<0)
-        return 0;
-      }
-    f->off = original;
-    } 
-    else if (flags == 3 || flags == 1){
-      f->off = offset;
-      for(cur=0; cur<length; cur+=PGSIZE){
-        mem = kalloc();
-        if(!mem) 
-          return 0;
-        memset(mem, 0, PGSIZE);
-        if(mappages(p->pgdir, (void*)(addr + cur), PGSIZE, V2P(mem), prot|PTE_U)==-1)
-          return 0;
-      }
-    }
+  np->state = RUNNABLE;
 
+  release(&ptable.lock);
 
+  return pid;
+}
 
-  acquire(&ptable.lock);
+// Like fork(), but the child borrows the parent's address space
+// instead of copying it, and the parent sleeps until the child
+// calls exec() or exit(). The child must not return from the
+// function that called vfork() or change memory the parent is
+// using. Until then the child also reads the parent's vdso page,
+// so that page shows the child's pid while the parent sleeps.
+int
+vfork(void)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
 
+  if((np = allocproc()) == 0)
+    return -1;
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  np->vfork = 1;
+  np->parent = curproc;
+  *np->tf = *curproc->tf;
+
+  // Clear %eax so that vfork returns 0 in the child.
+  np->tf->eax = 0;
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+  execdup(np, curproc);
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  pid = np->pid;
+  vdsoprocinit(curproc->vdso, pid);
+
+  acquire(&ptable.lock);
   np->state = RUNNABLE;
+  while(np->vfork)
+    sleep(curproc, &ptable.lock);
+  release(&ptable.lock);
+  return pid;
+}
+
+// Called by a vfork() child that has switched to its own
+// address space: let the parent run again.
+void
+vforkdone(void)
+{
+  struct proc *curproc = myproc();
 
+  acquire(&ptable.lock);
+  curproc->vfork = 0;
+  vdsoprocinit(curproc->parent->vdso, curproc->parent->pid);
+  wakeup1(curproc->parent);
   release(&ptable.lock);
+}
 
+// Start a child running the program at path, without copying
+// the current address space the way fork() would. ofile is the
+// child's file table; spawn() takes over its references, even
+// when it fails.
+int
+spawn(char *path, char **argv, struct file **ofile)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if((np = allocproc()) == 0)
+    goto bad;
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  np->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  np->tf->es = np->tf->ds;
+  np->tf->ss = np->tf->ds;
+  np->tf->eflags = FL_IF;
+  if(execload(np, path, argv, &np->pgdir, &np->sz) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    kfree(np->vdso);
+    np->vdso = 0;
+    np->state = UNUSED;
+    goto bad;
+  }
+  np->parent = curproc;
+  for(i = 0; i < NOFILE; i++)
+    np->ofile[i] = ofile[i];
+  np->cwd = idup(curproc->cwd);
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  release(&ptable.lock);
   return pid;
+
+bad:
+  for(i = 0; i < NOFILE; i++)
+    if(ofile[i])
+      fileclose(ofile[i]);
+  return -1;
 }
 
 // Exit the current process.  Does not return.
@@ -302,6 +365,8 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  mmapexit(curproc);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -312,12 +377,24 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe){
+    itext(curproc->exe, -1);
+    iput(curproc->exe);
+  }
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
-  // Parent might be sleeping in wait().
+  // A vfork() child gives the address space back to its parent.
+  if(curproc->vfork){
+    curproc->vfork = 0;
+    curproc->pgdir = 0;
+    vdsoprocinit(curproc->parent->vdso, curproc->parent->pid);
+  }
+
+  // Parent might be sleeping in wait() or vfork().
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
@@ -357,7 +434,11 @@ wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
+        kfree(p->vdso);
+        p->vdso = 0;
+        if(p->pgdir)
+          freevm(p->pgdir);
+        p->pgdir = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -392,6 +473,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
   
   for(;;){
@@ -399,10 +481,12 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if(p->state != RUNNABLE)
         continue;
+      ran = 1;
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
@@ -420,6 +504,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 
+    // Nothing to run: use the time to zero pages for kalloc_zeroed().
+    if(!ran)
+      kzerofill();
   }
 }
 
@@ -564,6 +651,36 @@ kill(int pid)
   return -1;
 }
 
+// Copy the system call counts of the process with the given pid.
+int
+getsyscount(int pid, uint *counts)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      memmove(counts, p->syscount, sizeof(p->syscount));
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Clear every process's system call counts.
+void
+resetsyscount(void)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    memset(p->syscount, 0, sizeof(p->syscount));
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -8,6 +8,8 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // User page table in cr3, or 0
+  volatile uint tlbstale;      // Shootdown pending, see tlbflush()
 };
 
 extern struct cpu cpus[NCPU];
@@ -35,10 +37,12 @@ struct context {
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 
-#define MAX_MMAP_AREAS 64
-
 struct proc;
 
+// A mapping made by mmap(), allocated from a slab cache and
+// kept on its process's p->mmaps list.
+#define MMAPBASE 0x40000000  // mmap() addresses are relative to this
+
 struct mmap_area {
   struct file *f;
   uint addr;
@@ -47,15 +51,46 @@ struct mmap_area {
   int prot;
   int flags;
   struct proc *p; // the process with this mmap_area
+  uint ranext;    // fault address that continues a sequential scan
+  int rawin;      // pages the last fault mapped
+  struct mmap_area *next;
 };
 
-struct mmap_area mmap_areas[MAX_MMAP_AREAS];
+// A loadable ELF segment of the running program. Its pages are
+// read from the executable on first touch; see execpage().
+#define NEXECSEG 4
+
+// User memory kept in by prefault() until the system call returns.
+#define NPIN 4
+
+struct pinrange {
+  uint va;                     // Page-aligned start
+  uint end;
+};
+
+struct execseg {
+  uint va;                     // Page-aligned start
+  uint off;                    // Offset of va in the executable
+  uint filesz;                 // Bytes backed by the file; the rest is zero
+  uint memsz;
+};
 
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
+  char *vdso;                  // Private vdso page, mapped at VDSOPROC
+  uint ringva;                 // User address of registered I/O ring, or 0
+  int vfork;                   // Borrowing the parent's address space (vfork())
+  struct inode *exe;           // Executable the image is paged in from
+  int nseg;
+  struct execseg seg[NEXECSEG];
+  struct mmap_area *mmaps;     // mmap() mappings, sorted by address
+  struct mmap_area *mmaphint;  // Last mapping findmmap() returned
+  uint syscount[NSYSSTAT];     // System calls made, while sysstat is on
+  int npin;
+  struct pinrange pin[NPIN];   // See unpinuser()
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -12,6 +13,7 @@
 #define BACK  5
 
 #define MAXARGS 10
+#define MAXACTS 10
 
 struct cmd {
   int type;
@@ -52,12 +54,15 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+int start(struct cmd*, struct spawnact*, int);
 
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
 {
-  int p[2];
+  int p[2], n;
+  struct spawnact acts[3];
   struct backcmd *bcmd;
   struct execcmd *ecmd;
   struct listcmd *lcmd;
@@ -91,9 +96,8 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(lcmd->left);
-    wait();
+    if(start(lcmd->left, 0, 0) >= 0)
+      wait();
     runcmd(lcmd->right);
     break;
 
@@ -101,35 +105,85 @@ runcmd(struct cmd *cmd)
     pcmd = (struct pipecmd*)cmd;
     if(pipe(p) < 0)
       panic("pipe");
-    if(fork1() == 0){
-      close(1);
-      dup(p[1]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->left);
-    }
-    if(fork1() == 0){
-      close(0);
-      dup(p[0]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->right);
-    }
+    acts[0].op = SPAWN_DUP2;
+    acts[0].fd = p[1];
+    acts[0].newfd = 1;
+    acts[1].op = SPAWN_CLOSE;
+    acts[1].fd = p[0];
+    acts[2].op = SPAWN_CLOSE;
+    acts[2].fd = p[1];
+    n = start(pcmd->left, acts, 3) >= 0;
+    acts[0].fd = p[0];
+    acts[0].newfd = 0;
+    n += start(pcmd->right, acts, 3) >= 0;
     close(p[0]);
     close(p[1]);
-    wait();
-    wait();
+    while(n-- > 0)
+      wait();
     break;
 
   case BACK:
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(bcmd->cmd);
+    start(bcmd->cmd, 0, 0);
     break;
   }
   exit();
 }
 
+// Is cmd a program to run, possibly with redirections?
+int
+simple(struct cmd *cmd)
+{
+  while(cmd && cmd->type == REDIR)
+    cmd = ((struct redircmd*)cmd)->cmd;
+  return cmd && cmd->type == EXEC && ((struct execcmd*)cmd)->argv[0] != 0;
+}
+
+// Run cmd in a child process after applying the file descriptor
+// actions acts[0..nact-1]. Simple commands are started with
+// spawn(), so the shell's memory is not copied; anything else
+// needs a forked shell. Returns the child's pid, or -1.
+int
+start(struct cmd *cmd, struct spawnact *acts, int nact)
+{
+  struct spawnact a[MAXACTS+1];
+  struct redircmd *rcmd;
+  struct execcmd *ecmd;
+  int i, pid;
+
+  if(!simple(cmd)){
+    if((pid = fork1()) == 0){
+      for(i = 0; i < nact; i++){
+        close(acts[i].op == SPAWN_DUP2 ? acts[i].newfd : acts[i].fd);
+        if(acts[i].op == SPAWN_DUP2)
+          dup(acts[i].fd);
+      }
+      runcmd(cmd);
+    }
+    return pid;
+  }
+
+  for(i = 0; i < nact; i++)
+    a[i] = acts[i];
+  for(; cmd->type == REDIR; cmd = rcmd->cmd){
+    rcmd = (struct redircmd*)cmd;
+    if(i >= MAXACTS){
+      printf(2, "too many redirections\n");
+      return -1;
+    }
+    a[i].op = SPAWN_OPEN;
+    a[i].fd = rcmd->fd;
+    a[i].path = rcmd->file;
+    a[i].omode = rcmd->mode;
+    i++;
+  }
+  a[i].op = SPAWN_END;
+  ecmd = (struct execcmd*)cmd;
+  if((pid = spawn(ecmd->argv[0], ecmd->argv, a)) < 0)
+    printf(2, "exec %s failed\n", ecmd->argv[0]);
+  return pid;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,6 +199,7 @@ int
 main(void)
 {
   static char buf[100];
+  struct cmd *cmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -164,9 +219,11 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(start(cmd, 0, 0) >= 0)
+      wait();
+    freecmd(cmd);
   }
   exit();
 }
@@ -324,20 +381,38 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// The shell parses commands itself, so that simple ones can be
+// started with spawn(); a syntax error must not exit the shell.
+// syntax() reports one and makes parsecmd() return 0.
+int parseerr;
+
+void
+syntax(char *s)
+{
+  if(!parseerr)
+    printf(2, "%s\n", s);
+  parseerr = 1;
+}
+
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
   }
   nulterminate(cmd);
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
+  }
   return cmd;
 }
 
@@ -379,8 +454,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +482,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +510,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS - 1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +574,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a parsed command.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,187 @@
+// Slab allocator: caches of fixed-size kernel objects
+// (files, inodes, pipes, ...) built on kalloc().
+//
+// A slab is one page: a struct slab header, then a stack of the
+// indices of the slab's free objects, then the objects. The slab
+// of an object is found by rounding its address down to a page.
+// Free objects are tracked outside the objects themselves, so
+// an object keeps its constructed state while it is free.
+//
+// Each CPU keeps a magazine of up to MAGSIZE free objects per
+// cache. kmem_cache_alloc() and kmem_cache_free() only use the
+// magazine, with interrupts off, and take the cache lock to move
+// MAGSIZE/2 objects when it runs empty or full.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;   // on cache->partial
+  struct slab *prev;
+  char *objs;          // first object
+  uint nfree;          // entries in free[]
+  ushort free[];       // indices of free objects
+};
+
+// Offset of the first object in a slab of n objects.
+static uint
+objoff(uint n)
+{
+  return (sizeof(struct slab) + n*sizeof(ushort) + 7) & ~7;
+}
+
+// Set up cache c for objects of the given size. ctor, if not 0,
+// is called on each object when its slab is created.
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size,
+                void (*ctor)(void*))
+{
+  uint n;
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  c->ctor = ctor;
+  c->partial = 0;
+  c->nempty = 0;
+  c->nslab = 0;
+  n = (PGSIZE - sizeof(struct slab)) / (c->size + sizeof(ushort));
+  while(n > 0 && objoff(n) + n*c->size > PGSIZE)
+    n--;
+  if(n == 0)
+    panic("kmem_cache_init");
+  c->perslab = n;
+  memset(c->mag, 0, sizeof(c->mag));
+}
+
+static void
+slablink(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+static void
+slabunlink(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Add a new slab of constructed objects to c.
+// Caller holds c->lock.
+static struct slab*
+slabgrow(struct kmem_cache *c)
+{
+  struct slab *s;
+  uint i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->objs = (char*)s + objoff(c->perslab);
+  s->nfree = c->perslab;
+  for(i = 0; i < c->perslab; i++){
+    s->free[i] = c->perslab - 1 - i;
+    if(c->ctor)
+      c->ctor(s->objs + i*c->size);
+  }
+  slablink(c, s);
+  c->nempty++;
+  c->nslab++;
+  return s;
+}
+
+// Take an object from c's slabs. Caller holds c->lock.
+static void*
+slaballoc(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+    return 0;
+  if(s->nfree == c->perslab)
+    c->nempty--;
+  obj = s->objs + s->free[--s->nfree] * c->size;
+  if(s->nfree == 0)
+    slabunlink(c, s);
+  return obj;
+}
+
+// Return obj to its slab. A slab that becomes unused goes back
+// to kalloc() unless it is the only unused one.
+// Caller holds c->lock.
+static void
+slabfree(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->cache != c || ((char*)obj - s->objs) % c->size)
+    panic("kmem_cache_free");
+  if(s->nfree == 0)
+    slablink(c, s);
+  s->free[s->nfree++] = ((char*)obj - s->objs) / c->size;
+  if(s->nfree == c->perslab){
+    if(c->nempty > 0){
+      slabunlink(c, s);
+      c->nslab--;
+      kfree((char*)s);
+    } else
+      c->nempty++;
+  }
+}
+
+// Allocate a constructed object from c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2 && (obj = slaballoc(c)) != 0)
+      m->obj[m->n++] = obj;
+    release(&c->lock);
+  }
+  obj = 0;
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  popcli();
+  return obj;
+}
+
+// Free obj, which must be in its constructed state.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slabfree(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  popcli();
+}
@@ -0,0 +1,28 @@
+// Object caches for fixed-size kernel structures.
+// Each cache carves whole pages (slabs) into objects of one size.
+// Objects are handed out in their constructed state: the
+// constructor runs once when a slab is created, and kmem_cache_free()
+// must return objects in the same state (e.g. locks released), so
+// it need not run again on the next allocation.
+
+#define MAGSIZE  16  // objects a CPU keeps in its magazine
+
+struct slab;
+
+// Per-CPU stack of free objects in front of the cache's slabs.
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  struct spinlock lock;         // protects the slab lists
+  char *name;
+  uint size;                    // object size, rounded up
+  uint perslab;                 // objects in one slab
+  void (*ctor)(void*);          // constructor, or 0
+  struct slab *partial;         // slabs with free objects
+  int nempty;                   // slabs on partial with no objects in use
+  uint nslab;                   // pages held
+  struct magazine mag[NCPU];
+};
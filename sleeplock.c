@@ -16,6 +16,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwaiting = 0;
   lk->pid = 0;
 }
 
@@ -23,9 +25,11 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->wwaiting++;
+  while (lk->locked || lk->readers) {
     sleep(lk, &lk->lk);
   }
+  lk->wwaiting--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
@@ -52,5 +56,38 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Shared (reader) side of the lock. Any number of readers may hold
+// it at once, but a reader waits while a writer holds the lock or is
+// waiting for it, so a stream of readers cannot starve a writer.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->wwaiting) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
 
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
 
+// Turn an exclusive hold into a shared one without letting
+// a writer in between. Waiting readers are woken to join.
+void
+downgradesleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->locked = 0;
+  lk->pid = 0;
+  lk->readers++;
+  wakeup(lk);
+  release(&lk->lk);
+}
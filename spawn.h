@@ -0,0 +1,16 @@
+// File descriptor actions for spawn(). Starting from a copy of
+// the caller's open files, the actions are applied in order to
+// build the child's; the list ends with SPAWN_END.
+
+#define SPAWN_END    0  // end of the list
+#define SPAWN_CLOSE  1  // close fd
+#define SPAWN_DUP2   2  // make newfd refer to fd's file
+#define SPAWN_OPEN   3  // open path with omode as fd
+
+struct spawnact {
+  int op;
+  int fd;
+  int newfd;
+  char *path;
+  int omode;
+};
@@ -0,0 +1,216 @@
+// Tests for spawn() and vfork().
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "spawn.h"
+
+char buf[512];
+int vforkflag;
+
+// Read fd to EOF into buf and return the number of bytes read.
+int
+readall(int fd)
+{
+  int i, n;
+
+  for(i = 0; i < sizeof(buf) - 1; i += n)
+    if((n = read(fd, buf + i, sizeof(buf) - 1 - i)) <= 0)
+      break;
+  buf[i] = 0;
+  return i;
+}
+
+// spawn() echo with each kind of file action and check where
+// its output went.
+void
+spawnacts(void)
+{
+  char *argv[] = { "echo", "spawn", "ok", 0 };
+  struct spawnact acts[4];
+  int pid, fd, fds[2];
+
+  printf(1, "spawn test\n");
+
+  // SPAWN_OPEN: stdout goes to a new file.
+  unlink("spawnout");
+  memset(acts, 0, sizeof(acts));
+  acts[0].op = SPAWN_OPEN;
+  acts[0].fd = 1;
+  acts[0].path = "spawnout";
+  acts[0].omode = O_CREATE|O_WRONLY;
+  if((pid = spawn("echo", argv, acts)) < 0){
+    printf(1, "spawn: SPAWN_OPEN failed\n");
+    exit();
+  }
+  if(wait() != pid){
+    printf(1, "spawn: wait failed\n");
+    exit();
+  }
+  if((fd = open("spawnout", O_RDONLY)) < 0){
+    printf(1, "spawn: spawnout not created\n");
+    exit();
+  }
+  if(readall(fd) != 9 || strcmp(buf, "spawn ok\n") != 0){
+    printf(1, "spawn: spawnout holds '%s'\n", buf);
+    exit();
+  }
+  close(fd);
+  unlink("spawnout");
+
+  // SPAWN_DUP2 and SPAWN_CLOSE: stdout is the write end of a pipe,
+  // and the child keeps no other pipe descriptors.
+  if(pipe(fds) != 0){
+    printf(1, "spawn: pipe failed\n");
+    exit();
+  }
+  memset(acts, 0, sizeof(acts));
+  acts[0].op = SPAWN_DUP2;
+  acts[0].fd = fds[1];
+  acts[0].newfd = 1;
+  acts[1].op = SPAWN_CLOSE;
+  acts[1].fd = fds[0];
+  acts[2].op = SPAWN_CLOSE;
+  acts[2].fd = fds[1];
+  if((pid = spawn("echo", argv, acts)) < 0){
+    printf(1, "spawn: SPAWN_DUP2 failed\n");
+    exit();
+  }
+  close(fds[1]);
+  if(readall(fds[0]) != 9 || strcmp(buf, "spawn ok\n") != 0){
+    printf(1, "spawn: pipe read '%s'\n", buf);
+    exit();
+  }
+  close(fds[0]);
+  wait();
+
+  // Actions apply in order: closing fd 1 after the dup2 leaves
+  // the child with no stdout, so nothing reaches the pipe.
+  if(pipe(fds) != 0){
+    printf(1, "spawn: pipe failed\n");
+    exit();
+  }
+  memset(acts, 0, sizeof(acts));
+  acts[0].op = SPAWN_DUP2;
+  acts[0].fd = fds[1];
+  acts[0].newfd = 1;
+  acts[1].op = SPAWN_CLOSE;
+  acts[1].fd = 1;
+  if((pid = spawn("echo", argv, acts)) < 0){
+    printf(1, "spawn: SPAWN_CLOSE failed\n");
+    exit();
+  }
+  close(fds[1]);
+  if(readall(fds[0]) != 0){
+    printf(1, "spawn: closed stdout still wrote '%s'\n", buf);
+    exit();
+  }
+  close(fds[0]);
+  wait();
+
+  // A bad action or program fails without starting a child.
+  memset(acts, 0, sizeof(acts));
+  acts[0].op = SPAWN_CLOSE;
+  acts[0].fd = NOFILE;
+  if(spawn("echo", argv, acts) >= 0 || spawn("nosuchprog", argv, 0) >= 0 ||
+     wait() != -1){
+    printf(1, "spawn: bad spawn succeeded\n");
+    exit();
+  }
+
+  printf(1, "spawn test ok\n");
+}
+
+// vfork() a child that exits, then one that execs. Each time the
+// parent must resume on its own stack with its memory intact.
+void
+vforkexit(void)
+{
+  char *argv[] = { "echo", "vfork", "ok", 0 };
+  volatile int canary;
+  char *p;
+  int pid, fd, mypid;
+
+  printf(1, "vfork test\n");
+
+  // The child runs in the parent's address space until it exits,
+  // but getpid() still tells the two apart.
+  mypid = getpid();
+  canary = 1234;
+  vforkflag = 0;
+  pid = vfork();
+  if(pid < 0){
+    printf(1, "vfork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    vforkflag = getpid();
+    exit();
+  }
+  if(canary != 1234 || vforkflag != pid || getpid() != mypid){
+    printf(1, "vfork+exit: canary %d child pid %d, not %d\n",
+           canary, vforkflag, pid);
+    exit();
+  }
+  if(wait() != pid){
+    printf(1, "vfork: wait failed\n");
+    exit();
+  }
+
+  // The child's file table is its own.
+  unlink("vforkout");
+  pid = vfork();
+  if(pid < 0){
+    printf(1, "vfork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(1);
+    if(open("vforkout", O_CREATE|O_WRONLY) == 1)
+      exec("echo", argv);
+    exit();
+  }
+  if(canary != 1234){
+    printf(1, "vfork+exec: canary %d\n", canary);
+    exit();
+  }
+  if(wait() != pid){
+    printf(1, "vfork: wait failed\n");
+    exit();
+  }
+  if((fd = open("vforkout", O_RDONLY)) < 0 ||
+     readall(fd) != 9 || strcmp(buf, "vfork ok\n") != 0){
+    printf(1, "vfork: vforkout holds '%s'\n", buf);
+    exit();
+  }
+  close(fd);
+  unlink("vforkout");
+
+  // Neither child may have freed the address space it borrowed.
+  p = sbrk(4096);
+  if(p == (char*)-1){
+    printf(1, "vfork: sbrk failed\n");
+    exit();
+  }
+  p[0] = p[4095] = 'v';
+  sbrk(-4096);
+  pid = fork();
+  if(pid == 0)
+    exit();
+  if(pid < 0 || wait() != pid){
+    printf(1, "vfork: fork failed\n");
+    exit();
+  }
+
+  printf(1, "vfork test ok\n");
+}
+
+int
+main(void)
+{
+  spawnacts();
+  vforkexit();
+  exit();
+}
@@ -0,0 +1,15 @@
+// Page swapping statistics (Project 5), read with the swapstat()
+// system call. The compression ratio of the pool is
+// zstored*PGSIZE / zbytes; its hit rate is zhits / nin.
+
+struct swapstat {
+  uint nout;        // pages swapped out
+  uint nin;         // pages swapped back in
+  uint zhits;       // of which found in the compressed pool
+  uint zrejects;    // pages that did not compress to half, sent to disk
+  uint zwriteback;  // pool entries written to disk to make room
+  uint zstored;     // pages now in the pool
+  uint zbytes;      // their compressed size
+  uint zpages;      // pages the pool takes up
+  uint ndisk;       // pages now on disk
+};
@@ -24,3 +24,8 @@
 #define SYS_getnice 23
 #define SYS_setnice 24
 #define SYS_ps 25
+#define SYS_ringsetup 26
+#define SYS_ringenter 27
+#define SYS_sysstat 28
+#define SYS_spawn 29
+#define SYS_vfork 30
@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "sysstat.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -19,7 +20,7 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(addr >= curproc->sz || addr+4 > curproc->sz || prefault(addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -39,6 +40,8 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && prefault((uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -66,6 +69,15 @@ arguint(int n, uint *old_ip)
 // lies within the process address space.
 int
 argptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, size, 1);
+}
+
+// Like argptr(), but only fault in the first use bytes of the
+// block, all the call can touch, and only for reading unless
+// write is set (see prefault()).
+int
+argbuf(int n, char **pp, int size, int use, int write)
 {
   int i;
   struct proc *curproc = myproc();
@@ -74,6 +86,10 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(use > size)
+    use = size;
+  if(use > 0 && prefault(i, use, write) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -115,6 +131,12 @@ extern int sys_uptime(void);
 extern int sys_mmap(void);
 extern int sys_munmap(void);
 extern int sys_freemem(void);
+extern int sys_ringsetup(void);
+extern int sys_ringenter(void);
+extern int sys_sysstat(void);
+extern int sys_spawn(void);
+extern int sys_vfork(void);
+extern int sys_swapstat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -141,20 +163,106 @@ static int (*syscalls[])(void) = {
 [SYS_mmap]    sys_mmap,
 [SYS_munmap]  sys_munmap,
 [SYS_freemem] sys_freemem,
+[SYS_ringsetup]  sys_ringsetup,
+[SYS_ringenter]  sys_ringenter,
+[SYS_sysstat]  sys_sysstat,
+[SYS_spawn]    sys_spawn,
+[SYS_vfork]    sys_vfork,
+[SYS_swapstat]  sys_swapstat,
 };
 
+// Per-CPU counters and latency histograms, summed when read.
+// Only collected while sysstat_on is set, so the disabled cost
+// is one branch per system call.
+static struct sysstat cpustat[NCPU];
+static int sysstat_on;
+
+static void
+sysstatrecord(int num, uint64 cycles)
+{
+  struct sysstat *st;
+  uint b, hi;
+
+  if(num >= NSYSSTAT)
+    return;
+  b = 0;
+  if((hi = cycles >> 32) != 0)
+    for(b = 32; hi >>= 1; b++)
+      ;
+  else
+    for(hi = cycles; hi >>= 1; b++)
+      ;
+  if(b >= NSTATBUCKET)
+    b = NSTATBUCKET - 1;
+
+  pushcli();
+  st = &cpustat[cpuid()];
+  st->count[num]++;
+  st->cycles[num] += cycles;
+  st->hist[num][b]++;
+  popcli();
+  myproc()->syscount[num]++;
+}
+
+int
+sys_sysstat(void)
+{
+  int cmd, pid, i, j, c;
+  struct sysstat *st;
+  uint *counts;
+
+  if(argint(0, &cmd) < 0 || argint(1, &pid) < 0)
+    return -1;
+  switch(cmd){
+  case SYSSTAT_OFF:
+  case SYSSTAT_ON:
+    sysstat_on = cmd;
+    return 0;
+  case SYSSTAT_RESET:
+    memset(cpustat, 0, sizeof(cpustat));
+    resetsyscount();
+    return 0;
+  case SYSSTAT_READ:
+    if(argptr(2, (void*)&st, sizeof(*st)) < 0)
+      return -1;
+    memset(st, 0, sizeof(*st));
+    for(c = 0; c < ncpu; c++){
+      for(i = 0; i < NSYSSTAT; i++){
+        st->count[i] += cpustat[c].count[i];
+        st->cycles[i] += cpustat[c].cycles[i];
+        for(j = 0; j < NSTATBUCKET; j++)
+          st->hist[i][j] += cpustat[c].hist[i][j];
+      }
+    }
+    return 0;
+  case SYSSTAT_PROC:
+    if(argptr(2, (void*)&counts, NSYSSTAT*sizeof(uint)) < 0)
+      return -1;
+    return getsyscount(pid, counts);
+  }
+  return -1;
+}
+
 void
 syscall(void)
 {
-  int num;
+  int num, ret;
+  uint64 t0;
   struct proc *curproc = myproc();
 
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-    curproc->tf->eax = syscalls[num]();
+    if(sysstat_on){
+      t0 = rdtsc();
+      ret = syscalls[num]();
+      sysstatrecord(num, rdtsc() - t0);
+      curproc->tf->eax = ret;
+    } else
+      curproc->tf->eax = syscalls[num]();
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
     curproc->tf->eax = -1;
   }
+  unpinuser();
 }
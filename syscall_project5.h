@@ -23,3 +23,9 @@
 #define SYS_mmap   22
 #define SYS_munmap 23
 #define SYS_freemem 24
+#define SYS_ringsetup 25
+#define SYS_ringenter 26
+#define SYS_sysstat 27
+#define SYS_spawn 28
+#define SYS_vfork 29
+#define SYS_swapstat 30
@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "ioring.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -73,7 +75,8 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 ||
+     argbuf(1, &p, n, filereadmax(f, n), 1) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -85,7 +88,7 @@ sys_write(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argbuf(1, &p, n, n, 0) < 0)
     return -1;
   return filewrite(f, p, n);
 }
@@ -257,8 +260,10 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -274,52 +279,57 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+  if(dirlink(dp, name, ip->inum) < 0){
+    // name exists after all: dirlookup() above had no memory
+    // for its inode. Free ip again.
+    if(type == T_DIR){
+      dp->nlink--;
+      iupdate(dp);
+    }
+    iunlockput(dp);
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    return 0;
+  }
 
   iunlockput(dp);
 
   return ip;
 }
 
-int
-sys_open(void)
+// Open path and return a new file structure for it.
+static struct file*
+openfile(char *path, int omode)
 {
-  char *path;
-  int fd, omode;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
-    return -1;
-
   begin_op();
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
   iunlock(ip);
   end_op();
@@ -329,9 +339,36 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  return f;
+}
+
+// Open path and install it in a new file descriptor.
+static int
+fileopen(char *path, int omode)
+{
+  int fd;
+  struct file *f;
+
+  if((f = openfile(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
+int
+sys_open(void)
+{
+  char *path;
+  int omode;
+
+  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return fileopen(path, omode);
+}
+
 int
 sys_mkdir(void)
 {
@@ -393,19 +430,17 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the null-terminated array of strings at user address
+// uargv into argv[MAXARG].
+static int
+fetchargv(uint uargv, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
-  uint uargv, uarg;
+  uint uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -416,9 +451,96 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+  uint uargv;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
   return exec(path, argv);
 }
 
+// Apply one spawn() action to the child's file table ofile.
+static int
+spawnact(struct file **ofile, struct spawnact *a)
+{
+  struct file *f;
+  char *path;
+
+  if(a->fd < 0 || a->fd >= NOFILE)
+    return -1;
+  switch(a->op){
+  case SPAWN_CLOSE:
+    f = 0;
+    break;
+  case SPAWN_DUP2:
+    if(a->newfd < 0 || a->newfd >= NOFILE || ofile[a->fd] == 0)
+      return -1;
+    if(a->newfd == a->fd)
+      return 0;
+    f = filedup(ofile[a->fd]);
+    a->fd = a->newfd;
+    break;
+  case SPAWN_OPEN:
+    if(fetchstr((uint)a->path, &path) < 0 || (f = openfile(path, a->omode)) == 0)
+      return -1;
+    break;
+  default:
+    return -1;
+  }
+  if(ofile[a->fd])
+    fileclose(ofile[a->fd]);
+  ofile[a->fd] = f;
+  return 0;
+}
+
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  int i;
+  uint uargv, uacts;
+  struct spawnact a;
+  struct file *ofile[NOFILE];
+  struct proc *curproc = myproc();
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 ||
+     argint(2, (int*)&uacts) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  for(i = 0; i < NOFILE; i++)
+    ofile[i] = curproc->ofile[i] ? filedup(curproc->ofile[i]) : 0;
+  for(; uacts; uacts += sizeof(a)){
+    if(fetchint(uacts, &a.op) < 0 ||
+       fetchint(uacts+4, &a.fd) < 0 ||
+       fetchint(uacts+8, &a.newfd) < 0 ||
+       fetchint(uacts+12, (int*)&a.path) < 0 ||
+       fetchint(uacts+16, &a.omode) < 0)
+      goto bad;
+    if(a.op == SPAWN_END)
+      break;
+    if(spawnact(ofile, &a) < 0)
+      goto bad;
+  }
+  return spawn(path, argv, ofile);
+
+bad:
+  for(i = 0; i < NOFILE; i++)
+    if(ofile[i])
+      fileclose(ofile[i]);
+  return -1;
+}
+
 int
 sys_pipe(void)
 {
@@ -442,3 +564,128 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+//PAGEBREAK!
+// Batched I/O ring; see ioring.h.
+
+// Check that [addr, addr+n) lies within the process, and fault in
+// its first use bytes for reading, or writing if write is set (see
+// argbuf()).
+static int
+uvalid(uint addr, int n, int use, int write)
+{
+  struct proc *curproc = myproc();
+
+  if(n < 0 || addr >= curproc->sz || addr+n > curproc->sz || addr+n < addr)
+    return -1;
+  if(use > n)
+    use = n;
+  return use > 0 ? prefault(addr, use, write) : 0;
+}
+
+// Look up the registered ring, rechecking it against the current
+// size of the process since it may have shrunk since ringsetup().
+static struct ioring*
+curring(void)
+{
+  uint va = myproc()->ringva;
+
+  if(va == 0 || uvalid(va, PGSIZE, PGSIZE, 1) < 0)
+    return 0;
+  return (struct ioring*)va;
+}
+
+// Execute one request the same way its system call would.
+static int
+ringop(struct iosqe *e)
+{
+  struct proc *curproc = myproc();
+  struct file *f;
+  char *path;
+
+  if(e->op == IORING_OP_NOP)
+    return 0;
+  if(e->op == IORING_OP_OPEN){
+    if(fetchstr(e->addr, &path) < 0)
+      return -1;
+    return fileopen(path, e->len);
+  }
+  if(e->fd < 0 || e->fd >= NOFILE || (f = curproc->ofile[e->fd]) == 0)
+    return -1;
+  switch(e->op){
+  case IORING_OP_READ:
+    if(uvalid(e->addr, e->len, filereadmax(f, e->len), 1) < 0)
+      return -1;
+    return fileread(f, (char*)e->addr, e->len);
+  case IORING_OP_WRITE:
+    if(uvalid(e->addr, e->len, e->len, 0) < 0)
+      return -1;
+    return filewrite(f, (char*)e->addr, e->len);
+  case IORING_OP_CLOSE:
+    curproc->ofile[e->fd] = 0;
+    fileclose(f);
+    return 0;
+  case IORING_OP_FSTAT:
+    if(uvalid(e->addr, sizeof(struct stat), sizeof(struct stat), 1) < 0)
+      return -1;
+    return filestat(f, (struct stat*)e->addr);
+  }
+  return -1;
+}
+
+// Register the page at addr as this process's I/O ring,
+// or unregister with addr 0.
+int
+sys_ringsetup(void)
+{
+  uint addr;
+  struct ioring *r;
+
+  if(argint(0, (int*)&addr) < 0)
+    return -1;
+  if(addr == 0){
+    myproc()->ringva = 0;
+    return 0;
+  }
+  if(addr % PGSIZE != 0 || uvalid(addr, PGSIZE, PGSIZE, 1) < 0)
+    return -1;
+  r = (struct ioring*)addr;
+  r->sqhead = r->sqtail = 0;
+  r->cqhead = r->cqtail = 0;
+  myproc()->ringva = addr;
+  return 0;
+}
+
+// Consume up to n queued requests, posting a completion for each.
+// Every request runs to completion before the next one starts, so
+// when ringenter() returns all of the consumed requests have their
+// completions posted, and there is never anything more to wait
+// for. Stops early if the completion queue fills up. Returns the
+// number of requests consumed.
+int
+sys_ringenter(void)
+{
+  struct ioring *r;
+  struct iosqe e;
+  struct iocqe *c;
+  int n, done;
+
+  if(argint(0, &n) < 0 || (r = curring()) == 0)
+    return -1;
+
+  for(done = 0; done < n && r->sqhead != r->sqtail; done++){
+    if(r->cqtail - r->cqhead >= IORING_NCQ)
+      break;
+    // Copy the request so a misbehaving process can't change it
+    // while the kernel is using it.
+    e = r->sq[r->sqhead % IORING_NSQ];
+    r->sqhead++;
+    c = &r->cq[r->cqtail % IORING_NCQ];
+    c->data = e.data;
+    c->res = ringop(&e);
+    r->cqtail++;
+    if(myproc()->killed)
+      break;
+  }
+  return done;
+}
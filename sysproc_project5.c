@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "swap.h"
 
 int
 sys_fork(void)
@@ -13,6 +14,12 @@ sys_fork(void)
   return fork();
 }
 
+int
+sys_vfork(void)
+{
+  return vfork();
+}
+
 int
 sys_exit(void)
 {
@@ -127,3 +134,15 @@ int
 sys_freemem(void){
   return freemem();
 }
+
+int
+sys_swapstat(void)
+{
+  struct swapstat *st, s;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  swapstat(&s);
+  *st = s;
+  return 0;
+}
@@ -0,0 +1,124 @@
+// Print system call counts and latency histograms.
+//   sysstat on|off|reset   control collection
+//   sysstat                print totals for all processes
+//   sysstat pid            print one process's counts
+
+#include "types.h"
+#include "stat.h"
+#include "param.h"
+#include "user.h"
+#include "syscall.h"
+#include "sysstat.h"
+
+static char *names[NSYSSTAT] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+#ifdef SYS_getnice
+[SYS_getpname] "getpname",
+[SYS_getnice] "getnice",
+[SYS_setnice] "setnice",
+[SYS_ps]      "ps",
+#endif
+#ifdef SYS_mmap
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_freemem] "freemem",
+#endif
+[SYS_ringsetup] "ringsetup",
+[SYS_ringenter] "ringenter",
+[SYS_sysstat] "sysstat",
+[SYS_spawn]   "spawn",
+[SYS_vfork]   "vfork",
+#ifdef SYS_swapstat
+[SYS_swapstat] "swapstat",
+#endif
+};
+
+static struct sysstat st;
+
+static char*
+name(int num)
+{
+  return names[num] ? names[num] : "?";
+}
+
+static void
+showall(void)
+{
+  int i, b;
+  uint64 cyc;
+  uint n;
+
+  if(sysstat(SYSSTAT_READ, 0, &st) < 0){
+    printf(2, "sysstat: read failed\n");
+    exit();
+  }
+  for(i = 1; i < NSYSSTAT; i++){
+    if(st.count[i] == 0)
+      continue;
+    // Average without 64-bit division: scale both down together.
+    cyc = st.cycles[i];
+    n = st.count[i];
+    while(cyc >> 32){
+      cyc >>= 1;
+      n = (n >> 1) | 1;
+    }
+    printf(1, "%s (%d): %d calls, avg %d cycles\n",
+           name(i), i, st.count[i], (uint)cyc / n);
+    for(b = 0; b < NSTATBUCKET; b++)
+      if(st.hist[i][b])
+        printf(1, "    2^%d cycles: %d\n", b, st.hist[i][b]);
+  }
+}
+
+static void
+showproc(int pid)
+{
+  uint counts[NSYSSTAT];
+  int i;
+
+  if(sysstat(SYSSTAT_PROC, pid, counts) < 0){
+    printf(2, "sysstat: no process %d\n", pid);
+    exit();
+  }
+  for(i = 1; i < NSYSSTAT; i++)
+    if(counts[i])
+      printf(1, "%s (%d): %d calls\n", name(i), i, counts[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 2)
+    showall();
+  else if(strcmp(argv[1], "on") == 0)
+    sysstat(SYSSTAT_ON, 0, 0);
+  else if(strcmp(argv[1], "off") == 0)
+    sysstat(SYSSTAT_OFF, 0, 0);
+  else if(strcmp(argv[1], "reset") == 0)
+    sysstat(SYSSTAT_RESET, 0, 0);
+  else if(argv[1][0] >= '0' && argv[1][0] <= '9')
+    showproc(atoi(argv[1]));
+  else
+    printf(2, "usage: sysstat [on|off|reset|pid]\n");
+  exit();
+}
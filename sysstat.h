@@ -0,0 +1,18 @@
+// System call statistics, collected by syscall() while enabled
+// and read with the sysstat() system call.
+
+#define NSTATBUCKET  48  // latency histogram: bucket b counts calls
+                         // that took [2^b, 2^(b+1)) TSC cycles
+
+// sysstat() commands
+#define SYSSTAT_OFF    0  // stop collecting
+#define SYSSTAT_ON     1  // start collecting
+#define SYSSTAT_RESET  2  // zero all counters
+#define SYSSTAT_READ   3  // copy the totals into a struct sysstat
+#define SYSSTAT_PROC   4  // copy process pid's uint[NSYSSTAT] counts
+
+struct sysstat {
+  uint count[NSYSSTAT];                // calls per system call number
+  uint64 cycles[NSYSSTAT];             // total TSC cycles spent
+  uint hist[NSYSSTAT][NSTATBUCKET];    // log2 latency histogram
+};
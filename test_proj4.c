@@ -163,10 +163,92 @@ void anon_private_fork_test() {
 
 
 
+// Shared file backed mapping: stores reach other mappers and
+// read(), and write() reaches the mapping
+void file_shared_test() {
+  printf(1, "file backed shared mapping test\n");
+  char buf[512];
+  int i, fd = open("mmapshared", O_CREATE | O_RDWR);
+  if (fd == -1) {
+    printf(1, "file backed shared mapping test failed: at open\n");
+    exit();
+  }
+  memset(buf, 'a', sizeof(buf));
+  for (i = 0; i < 8; i++)
+    write(fd, buf, sizeof(buf));
+  char *p = (char*)mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == 0) {
+    printf(1, "file backed shared mapping test failed: at mmap\n");
+    exit();
+  }
+  if (fork() == 0) {
+    p[100] = 'b';
+    exit();
+  }
+  wait();
+  if (p[100] != 'b') {
+    printf(1, "file backed shared mapping test failed: child store lost\n");
+    exit();
+  }
+  int fd2 = open("mmapshared", O_RDWR);
+  if (read(fd2, buf, sizeof(buf)) != sizeof(buf) || buf[100] != 'b') {
+    printf(1, "file backed shared mapping test failed: read\n");
+    exit();
+  }
+  write(fd2, "c", 1);  // at offset 512
+  close(fd2);
+  if (p[512] != 'c') {
+    printf(1, "file backed shared mapping test failed: write\n");
+    exit();
+  }
+  munmap((uint)p);
+  close(fd);
+  unlink("mmapshared");
+  printf(1, "file backed shared mapping test ok\n");
+}
+
+// Huge anonymous mapping: 4MB pages, copied for a private child,
+// and the 4MB pages freed by munmap
+void anon_huge_test() {
+  printf(1, "anonymous huge mapping test\n");
+  int size = 2 * BIGPGSIZE;
+  int before = freemem();
+  char *p = (char*)mmap(2 * BIGPGSIZE, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_HUGE, -1, 0);
+  if (p == 0) {
+    printf(1, "anonymous huge mapping test failed: at mmap\n");
+    exit();
+  }
+  int i;
+  for (i = 0; i < size; i += 3 * PGSIZE + 8)
+    p[i] = i % 251;
+  if (fork() == 0) {
+    for (i = 0; i < size; i += 3 * PGSIZE + 8)
+      if (p[i] != i % 251) {
+        printf(1, "anonymous huge mapping test failed: child read\n");
+        exit();
+      }
+    p[0] = 'c';
+    exit();
+  }
+  wait();
+  if (p[0] != 0 || p[size - 1] != 0) {
+    printf(1, "anonymous huge mapping test failed: child store shared\n");
+    exit();
+  }
+  munmap((uint)p);
+  if (freemem() <= before - BIGPGSIZE / PGSIZE) {  // a whole 4MB page
+    printf(1, "anonymous huge mapping test failed: leaked %d pages\n", before - freemem());
+    exit();
+  }
+  printf(1, "anonymous huge mapping test ok\n");
+}
+
 int main()
 {
 //    file_private_test();
 file_private_with_fork_test();
+file_shared_test();
+anon_huge_test();
 //printf(1, "%d\n", freemem());
 
 }
@@ -10,6 +10,7 @@
 #include "fs.h"
 #include "proc.h"
 #include "syscall.h"
+#include "swap.h"
 
 
 // Simple private file backed mapping test
@@ -163,10 +164,154 @@ void anon_private_fork_test() {
 
 
 
+// Shared file backed mapping: stores reach other mappers and
+// read(), and write() reaches the mapping
+void file_shared_test() {
+  printf(1, "file backed shared mapping test\n");
+  char buf[512];
+  int i, fd = open("mmapshared", O_CREATE | O_RDWR);
+  if (fd == -1) {
+    printf(1, "file backed shared mapping test failed: at open\n");
+    exit();
+  }
+  memset(buf, 'a', sizeof(buf));
+  for (i = 0; i < 8; i++)
+    write(fd, buf, sizeof(buf));
+  char *p = (char*)mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == 0) {
+    printf(1, "file backed shared mapping test failed: at mmap\n");
+    exit();
+  }
+  if (fork() == 0) {
+    p[100] = 'b';
+    exit();
+  }
+  wait();
+  if (p[100] != 'b') {
+    printf(1, "file backed shared mapping test failed: child store lost\n");
+    exit();
+  }
+  int fd2 = open("mmapshared", O_RDWR);
+  if (read(fd2, buf, sizeof(buf)) != sizeof(buf) || buf[100] != 'b') {
+    printf(1, "file backed shared mapping test failed: read\n");
+    exit();
+  }
+  write(fd2, "c", 1);  // at offset 512
+  close(fd2);
+  if (p[512] != 'c') {
+    printf(1, "file backed shared mapping test failed: write\n");
+    exit();
+  }
+  munmap((uint)p);
+  close(fd);
+  unlink("mmapshared");
+  printf(1, "file backed shared mapping test ok\n");
+}
+
+// Huge anonymous mapping: 4MB pages, copied for a private child,
+// and the 4MB pages freed by munmap
+void anon_huge_test() {
+  printf(1, "anonymous huge mapping test\n");
+  int size = 2 * BIGPGSIZE;
+  int before = freemem();
+  char *p = (char*)mmap(2 * BIGPGSIZE, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_HUGE, -1, 0);
+  if (p == 0) {
+    printf(1, "anonymous huge mapping test failed: at mmap\n");
+    exit();
+  }
+  int i;
+  for (i = 0; i < size; i += 3 * PGSIZE + 8)
+    p[i] = i % 251;
+  if (fork() == 0) {
+    for (i = 0; i < size; i += 3 * PGSIZE + 8)
+      if (p[i] != i % 251) {
+        printf(1, "anonymous huge mapping test failed: child read\n");
+        exit();
+      }
+    p[0] = 'c';
+    exit();
+  }
+  wait();
+  if (p[0] != 0 || p[size - 1] != 0) {
+    printf(1, "anonymous huge mapping test failed: child store shared\n");
+    exit();
+  }
+  munmap((uint)p);
+  if (freemem() <= before - BIGPGSIZE / PGSIZE) {  // a whole 4MB page
+    printf(1, "anonymous huge mapping test failed: leaked %d pages\n", before - freemem());
+    exit();
+  }
+  printf(1, "anonymous huge mapping test ok\n");
+}
+
+// Page replacement: touch more heap than there is free memory, so
+// that pages go out to swap, and check they all come back. The
+// pages are mostly zero, so the compressed pool should take them.
+// Fill page i of the swap test. Every fourth page is random, which
+// does not compress and must go to disk; the rest hold a pattern the
+// pool takes.
+int swap_fill(char *pg, int i, int check) {
+  uint x = i * 2654435761u + 1;
+  int j;
+  for (j = 0; j < PGSIZE; j += 4) {
+    uint v;
+    if (i % 4 == 0) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      v = x;
+    } else
+      v = (i << 8) | (j % 251);
+    if (!check)
+      *(uint*)(pg + j) = v;
+    else if (*(uint*)(pg + j) != v)
+      return 1;
+  }
+  return 0;
+}
+
+void swap_test() {
+  struct swapstat st;
+  printf(1, "swap test\n");
+  // Past what is free, and past what the pool could hold in memory.
+  int n = freemem() + 1024;
+  char *p = sbrk(n * PGSIZE);
+  if (p == (char*)-1) {
+    printf(1, "swap test failed: at sbrk\n");
+    exit();
+  }
+  int i;
+  for (i = 0; i < n; i++)
+    swap_fill(p + i * PGSIZE, i, 0);
+  for (i = 0; i < n; i++)
+    if (swap_fill(p + i * PGSIZE, i, 1)) {
+      printf(1, "swap test failed: page %d\n", i);
+      exit();
+    }
+  sbrk(-n * PGSIZE);
+  if (swapstat(&st) < 0 || st.nout == 0) {
+    printf(1, "swap test failed: nothing swapped out\n");
+    exit();
+  }
+  printf(1, "swapped out %d, in %d (%d from the pool), %d written to disk\n",
+         st.nout, st.nin, st.zhits, st.zrejects + st.zwriteback);
+  if (st.zbytes > 0)
+    printf(1, "pool: %d pages in %d, ratio %d:1\n",
+           st.zstored, st.zpages, st.zstored * PGSIZE / st.zbytes);
+  if (st.zrejects + st.zwriteback == 0) {
+    printf(1, "swap test failed: nothing went to disk\n");
+    exit();
+  }
+  printf(1, "swap test ok\n");
+}
+
 int main()
 {
 //    file_private_test();
 file_private_with_fork_test();
+file_shared_test();
+anon_huge_test();
+swap_test();
 //printf(1, "%d\n", freemem());
 
 }
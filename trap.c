@@ -12,6 +12,7 @@
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern char sysenter_entry[];  // trapasm.S
 struct spinlock tickslock;
 uint ticks;
 
@@ -65,11 +66,21 @@ trap(struct trapframe *tf)
     return;
   }
 
+  // SYSENTER does not clear TF, so a user program single-stepping
+  // over it traps on the first kernel instruction. Clear TF and go
+  // on; the system call itself is not stepped.
+  if(tf->trapno == T_DEBUG && (tf->cs&3) == 0 &&
+     tf->eip == (uint)sysenter_entry){
+    tf->eflags &= ~FL_TF;
+    return;
+  }
+
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks+=1000;
+      vdsotick();
       wakeup(&ticks);
       release(&tickslock);
     }
@@ -100,6 +111,10 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_TLBFLUSH:
+    tlbintr();
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -107,6 +122,18 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // A write to a page shared copy-on-write since fork().
+    if(myproc() && (tf->err & FEC_WR) && cowpage(myproc()->pgdir, rcr2()) == 0)
+      break;
+    // First touch of a heap page added by sbrk().
+    if(myproc() && !(tf->err & FEC_PR) && lazypage(myproc(), rcr2(), 1) == 0)
+      break;
+    // The kernel touched user memory that can not be backed.
+    if(myproc() && (tf->cs&3) == 0 && faultkill(myproc(), rcr2()) == 0)
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
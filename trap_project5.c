@@ -13,19 +13,10 @@
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern char sysenter_entry[];  // trapasm.S
 struct spinlock tickslock;
 uint ticks;
 
-struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE } type;
-  int ref; // reference count
-  char readable;
-  char writable;
-  struct pipe *pipe;
-  struct inode *ip;
-  uint off;
-};
-
 void
 tvinit(void)
 {
@@ -44,20 +35,17 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Fault in the page of an mmap() area at rcr2(). Returns -1 if
+// the address is in no area or the access is not allowed.
 int
 handle_page_fault(struct trapframe *tf) {
   struct proc *curproc = myproc();
   uint fault_addr = rcr2(); 
-  int is_write = tf->err & 2;  // 0이면 read, 1이면 write
-  struct mmap_area *area = 0;
+  int is_write = tf->err & FEC_WR;
+  struct mmap_area *area;
   
   // 3번: mmap 영역을 확인합니다.
-  for (int i = 0; i < 64; i++) {
-    if (mmap_areas[i].addr <= fault_addr && (mmap_areas[i].addr + mmap_areas[i].length) > fault_addr) {
-      area = &mmap_areas[i];
-      break;
-    }
-  }
+  area = findmmap(curproc, fault_addr);
   // 3번: 주소에 해당하는 mmap_area가 없는 경우
   if (!area) {
       return -1;
@@ -66,36 +54,7 @@ handle_page_fault(struct trapframe *tf) {
   if (is_write && !(area->prot & PROT_WRITE)) {
       return -1;
   }
-
-
-
-  char *mem;
-  mem = kalloc();
-  if (mem == 0) {
-    return -1; // 메모리 할당 실패
-  }
-  memset(mem, 0, PGSIZE);
-
-  // uint offst = fault_addr - area->addr;
-  // int r = 0;
-
-// 3. If it is file mapping, read file into the physical page with offset
-  if (!(area->flags & MAP_ANONYMOUS) && area->f->ip != 0) {
-    // ilock(area->f->ip);
-    // int curroff = (area->offset + offst) % PGSIZE;
-    // r = readi(area->f->ip, mem, area->offset + offst - curroff, PGSIZE);
-    // iunlock(area->f->ip);
-    fileread(area->f, mem, PGSIZE);
-  }
-  // if (r<0){
-  // }
-  // 페이지 테이블 만들기 및 적절하게 채우기
-  int pte_flags = PTE_U | (is_write ? PTE_W : 0);
-  if (mappages(curproc->pgdir, (void *)fault_addr, PGSIZE, V2P(mem), pte_flags) < 0) {
-      kfree(mem);
-      myproc()->killed = 1;
-  }
-  return 0;
+  return mmapfault(area, PGROUNDDOWN(fault_addr), is_write);
 }
 
 //PAGEBREAK: 41
@@ -112,11 +71,21 @@ trap(struct trapframe *tf)
     return;
   }
 
+  // SYSENTER does not clear TF, so a user program single-stepping
+  // over it traps on the first kernel instruction. Clear TF and go
+  // on; the system call itself is not stepped.
+  if(tf->trapno == T_DEBUG && (tf->cs&3) == 0 &&
+     tf->eip == (uint)sysenter_entry){
+    tf->eflags &= ~FL_TF;
+    return;
+  }
+
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
+      vdsotick();
       wakeup(&ticks);
       release(&tickslock);
     }
@@ -137,6 +106,10 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_TLBFLUSH:
+    tlbintr();
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -145,8 +118,18 @@ trap(struct trapframe *tf)
     break;
 
   case T_PGFLT:
-    handle_page_fault(tf);
-    break;
+    // A write to a page shared copy-on-write since fork().
+    if(myproc() && (tf->err & FEC_WR) && cowpage(myproc()->pgdir, rcr2()) == 0)
+      break;
+    // First touch of a heap page added by sbrk().
+    if(myproc() && !(tf->err & FEC_PR) && lazypage(myproc(), rcr2(), 1) == 0)
+      break;
+    if(myproc() && handle_page_fault(tf) == 0)
+      break;
+    // The kernel touched user memory that can not be backed.
+    if(myproc() && (tf->cs&3) == 0 && faultkill(myproc(), rcr2()) == 0)
+      break;
+    // fall through
 
   //PAGEBREAK: 13
   default:
@@ -7,3 +7,4 @@ typedef struct {
 	unsigned int high;
 	unsigned int low;
 } BigUInt;
+typedef unsigned long long uint64;
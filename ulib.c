@@ -3,6 +3,7 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "vdso.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -104,3 +105,57 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// The calls below read the kernel's vdso pages (see vdso.h)
+// instead of trapping into the kernel.
+
+int
+uptime(void)
+{
+  return ((struct vdsodata*)VDSOBASE)->ticks;
+}
+
+int
+getpid(void)
+{
+  return ((struct vdsoproc*)VDSOPROC)->pid;
+}
+
+int
+clock_gettime(int clockid, struct timespec *tp)
+{
+  struct vdsodata *vd = (struct vdsodata*)VDSOBASE;
+  uint seq, nticks, per, ns;
+  uint64 base, delta;
+
+  if(clockid != CLOCK_MONOTONIC)
+    return -1;
+
+  // Only seq is volatile, so keep the compiler from moving the
+  // other loads out from between the two reads of it. x86 does not
+  // reorder loads with each other, so no fence is needed.
+  do {
+    while((seq = vd->seq) & 1)
+      ;
+    asm volatile("" ::: "memory");
+    nticks = vd->nticks;
+    base = ((uint64)vd->tschi << 32) | vd->tsclo;
+    per = vd->tscpertick;
+    asm volatile("" ::: "memory");
+  } while(seq != vd->seq);
+
+  // Interpolate within the current tick with the TSC, clamped so
+  // that time never runs past the next tick. delta*TICKNS/per is
+  // then below TICKNS, so a single 64/32-bit divl cannot overflow.
+  ns = 0;
+  if(per != 0){
+    delta = rdtsc() - base;
+    if(delta >= per)
+      delta = per - 1;
+    delta *= TICKNS;
+    asm("divl %2" : "=a" (ns) : "A" (delta), "rm" (per) : "cc");
+  }
+  tp->tv_sec = nticks / TICKHZ;
+  tp->tv_nsec = (nticks % TICKHZ) * TICKNS + ns;
+  return 0;
+}
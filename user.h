@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct spawnact;
+struct timespec;
 
 // system calls
 int fork(void);
@@ -19,14 +21,17 @@ int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
-int getpid(void);
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
 int getpname(int);
 int getnice(int);
 int setnice(int pid, int value);
 void ps(int);
+int ringsetup(void*);
+int ringenter(int);
+int sysstat(int, int, void*);
+int spawn(char*, char**, struct spawnact*);
+int vfork(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -41,3 +46,6 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int uptime(void);
+int getpid(void);
+int clock_gettime(int, struct timespec*);
@@ -1,5 +1,8 @@
 struct stat;
 struct rtcdate;
+struct spawnact;
+struct swapstat;
+struct timespec;
 
 // system calls
 int fork(void);
@@ -19,13 +22,17 @@ int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
-int getpid(void);
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
 uint mmap(uint addr, int length, int prot, int flags, int fd, int offset);
 int munmap(uint addr);
 int freemem(void);
+int ringsetup(void*);
+int ringenter(int);
+int sysstat(int, int, void*);
+int spawn(char*, char**, struct spawnact*);
+int vfork(void);
+int swapstat(struct swapstat*);
 
 
 
@@ -43,3 +50,6 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int uptime(void);
+int getpid(void);
+int clock_gettime(int, struct timespec*);
@@ -7,6 +7,8 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "vdso.h"
+#include "ioring.h"
 
 char buf[8192];
 char name[3];
@@ -579,6 +581,83 @@ fourfiles(void)
   printf(1, "fourfiles ok\n");
 }
 
+// four processes read the same file at the same time while
+// another appends to it, to test shared inode locking.
+void
+sharedread(void)
+{
+  int fd, pid, i, j, n, pi;
+  char rbuf[100];
+
+  printf(1, "sharedread test\n");
+
+  unlink("sharedread");
+  fd = open("sharedread", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "create sharedread failed\n");
+    exit();
+  }
+  memset(buf, 'r', 500);
+  for(i = 0; i < 10; i++){
+    if(write(fd, buf, 500) != 500){
+      printf(1, "write sharedread failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  for(pi = 0; pi < 5; pi++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if(pi == 0){
+        // writer: rewrite the file under the readers
+        if((fd = open("sharedread", O_WRONLY)) < 0){
+          printf(1, "open sharedread failed\n");
+          exit();
+        }
+        memset(rbuf, 'r', sizeof(rbuf));
+        for(i = 0; i < 50; i++){
+          if(write(fd, rbuf, sizeof(rbuf)) != sizeof(rbuf)){
+            printf(1, "write sharedread failed\n");
+            exit();
+          }
+        }
+        close(fd);
+        exit();
+      }
+      for(j = 0; j < 20; j++){
+        if((fd = open("sharedread", O_RDONLY)) < 0){
+          printf(1, "open sharedread failed\n");
+          exit();
+        }
+        while((n = read(fd, rbuf, sizeof(rbuf))) > 0){
+          for(i = 0; i < n; i++){
+            if(rbuf[i] != 'r'){
+              printf(1, "sharedread wrong char\n");
+              exit();
+            }
+          }
+        }
+        if(n < 0){
+          printf(1, "sharedread read failed\n");
+          exit();
+        }
+        close(fd);
+      }
+      exit();
+    }
+  }
+
+  for(pi = 0; pi < 5; pi++)
+    wait();
+  unlink("sharedread");
+  printf(1, "sharedread ok\n");
+}
+
 // four processes create and delete different files in same directory
 void
 createdelete(void)
@@ -1347,7 +1426,7 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
+  // more than the 50 in-memory inodes xv6 used to have
   for(i = 0; i < 50 + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
@@ -1737,6 +1816,158 @@ void argptest()
   printf(1, "arg test passed\n");
 }
 
+// uptime(), getpid() and clock_gettime() read the vdso pages
+// instead of trapping; check they agree with the kernel and that
+// user code cannot write the pages.
+void
+vdsotest(void)
+{
+  int pid, fds[2], cpid, i;
+  struct timespec t0, t1;
+
+  printf(1, "vdso test\n");
+
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    cpid = getpid();
+    write(fds[1], &cpid, sizeof(cpid));
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &cpid, sizeof(cpid)) != sizeof(cpid) || cpid != pid){
+    printf(1, "vdso getpid %d, fork returned %d\n", cpid, pid);
+    exit();
+  }
+  close(fds[0]);
+  wait();
+
+  if(clock_gettime(CLOCK_MONOTONIC, &t0) < 0){
+    printf(1, "clock_gettime failed\n");
+    exit();
+  }
+  i = uptime();
+  sleep(2);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if(uptime() <= i || t1.tv_nsec >= 1000000000 ||
+     t1.tv_sec < t0.tv_sec ||
+     (t1.tv_sec == t0.tv_sec && t1.tv_nsec <= t0.tv_nsec)){
+    printf(1, "vdso clock did not advance\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid == 0){
+    ((struct vdsodata*)VDSOBASE)->ticks = 0;
+    printf(1, "vdso page is writable; test FAILED\n");
+    exit();
+  }
+  wait();
+  printf(1, "vdso test ok\n");
+}
+
+// queue a batch of open/write/close/read requests on an I/O ring
+// and check the completions.
+void
+ringtest(void)
+{
+  struct ioring *r;
+  struct iosqe *e;
+  struct iocqe *c;
+  char *p, rbuf[64];
+  int i, fd, n;
+
+  printf(1, "ring test\n");
+
+  p = sbrk(0);
+  p = sbrk(2*4096 - (uint)p % 4096);
+  r = (struct ioring*)(p + 4096 - (uint)p % 4096);
+  if(ringsetup(r) < 0){
+    printf(1, "ringsetup failed\n");
+    exit();
+  }
+
+  unlink("ringfile");
+  fd = open("ringfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create ringfile failed\n");
+    exit();
+  }
+  memset(buf, 'q', 40);
+  for(i = 0; i < 8; i++){
+    e = &r->sq[r->sqtail % IORING_NSQ];
+    e->op = IORING_OP_WRITE;
+    e->fd = fd;
+    e->addr = (uint)buf;
+    e->len = 40;
+    e->data = i;
+    r->sqtail++;
+  }
+  e = &r->sq[r->sqtail % IORING_NSQ];
+  e->op = IORING_OP_CLOSE;
+  e->fd = fd;
+  e->data = 100;
+  r->sqtail++;
+  if((n = ringenter(9)) != 9){
+    printf(1, "ringenter consumed %d\n", n);
+    exit();
+  }
+  for(i = 0; r->cqhead != r->cqtail; i++){
+    c = &r->cq[r->cqhead % IORING_NCQ];
+    if(c->data != (i < 8 ? i : 100) || c->res != (i < 8 ? 40 : 0)){
+      printf(1, "bad completion %d: %d %d\n", i, c->data, c->res);
+      exit();
+    }
+    r->cqhead++;
+  }
+
+  e = &r->sq[r->sqtail % IORING_NSQ];
+  e->op = IORING_OP_OPEN;
+  e->addr = (uint)"ringfile";
+  e->len = O_RDONLY;
+  r->sqtail++;
+  if(ringenter(1) != 1 || (fd = r->cq[r->cqhead % IORING_NCQ].res) < 0){
+    printf(1, "ring open failed\n");
+    exit();
+  }
+  r->cqhead++;
+  n = 0;
+  for(;;){
+    e = &r->sq[r->sqtail % IORING_NSQ];
+    e->op = IORING_OP_READ;
+    e->fd = fd;
+    e->addr = (uint)rbuf;
+    e->len = sizeof(rbuf);
+    r->sqtail++;
+    ringenter(1);
+    c = &r->cq[r->cqhead++ % IORING_NCQ];
+    if(c->res <= 0)
+      break;
+    for(i = 0; i < c->res; i++){
+      if(rbuf[i] != 'q'){
+        printf(1, "ring read wrong data\n");
+        exit();
+      }
+    }
+    n += c->res;
+  }
+  close(fd);
+  unlink("ringfile");
+  ringsetup(0);
+  if(n != 8*40){
+    printf(1, "ring read %d bytes\n", n);
+    exit();
+  }
+  printf(1, "ring test ok\n");
+}
+
 unsigned long randstate = 1;
 unsigned int
 rand()
@@ -1761,6 +1992,7 @@ main(int argc, char *argv[])
   linkunlink();
   concreate();
   fourfiles();
+  sharedread();
   sharedfd();
 
   bigargtest();
@@ -1796,6 +2028,8 @@ main(int argc, char *argv[])
   bigdir(); // slow
 
   uio();
+  vdsotest();
+  ringtest();
 
   exectest();
 
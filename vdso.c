@@ -0,0 +1,68 @@
+// Kernel side of the user-readable data pages; see vdso.h.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "vdso.h"
+
+// The shared page. It lives in kernel data, so it is never freed
+// and its physical address is simply V2P(vdsopage).
+char vdsopage[PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static int havetsc;
+static uint64 lasttsc;
+
+void
+vdsoinit(void)
+{
+  uint edx;
+
+  cpuidreg(1, 0, 0, 0, &edx);
+  havetsc = (edx & CPUID_TSC) != 0;
+  ((struct vdsodata*)vdsopage)->sysenter = (edx & CPUID_SEP) != 0;
+}
+
+// Publish the new tick. Called by the timer interrupt on cpu 0
+// with tickslock held, right after ticks is updated. Readers retry
+// while seq is odd or changed under them, so the stores to seq must
+// not be reordered around the data.
+void
+vdsotick(void)
+{
+  struct vdsodata *vd = (struct vdsodata*)vdsopage;
+  uint64 now, delta;
+
+  now = havetsc ? rdtsc() : 0;
+  delta = now - lasttsc;
+
+  vd->seq++;
+  __sync_synchronize();
+  vd->ticks = ticks;
+  vd->nticks++;
+  if(havetsc && lasttsc != 0 && delta < 0xFFFFFFFF){
+    // Smooth out interrupt latency jitter.
+    if(vd->tscpertick == 0)
+      vd->tscpertick = delta;
+    else
+      vd->tscpertick = vd->tscpertick - vd->tscpertick/4 + (uint)delta/4;
+  }
+  vd->tsclo = (uint)now;
+  vd->tschi = (uint)(now >> 32);
+  __sync_synchronize();
+  vd->seq++;
+
+  lasttsc = now;
+}
+
+// Fill in a new process's private page.
+void
+vdsoprocinit(char *page, int pid)
+{
+  struct vdsoproc *vp = (struct vdsoproc*)page;
+
+  memset(page, 0, PGSIZE);
+  vp->pid = pid;
+}
@@ -0,0 +1,37 @@
+// Kernel data that user programs can read without a system call.
+// Two read-only pages are mapped at VDSOBASE in every address space:
+// the first (struct vdsodata) is shared by all processes and updated
+// by the timer interrupt, the second (struct vdsoproc) is private to
+// the process. ulib.c reads them to implement uptime(), getpid()
+// and clock_gettime().
+
+#define VDSOBASE   0x7FFFE000              // just below KERNBASE
+#define VDSOPROC   (VDSOBASE + 0x1000)
+#define TICKNS     10000000                // nominal timer period (ns)
+#define TICKHZ     (1000000000 / TICKNS)
+
+// Address of vdsodata.sysenter, for the stubs in usys.S.
+#define VDSOSYSENTER  VDSOBASE
+
+#ifndef __ASSEMBLER__
+struct vdsodata {
+  uint sysenter;      // CPU has SYSENTER/SYSEXIT; must stay first
+  volatile uint seq;  // odd while the kernel is updating the fields below
+  uint ticks;         // value uptime() returns
+  uint nticks;        // timer interrupts since boot
+  uint tsclo;         // TSC at the last timer interrupt
+  uint tschi;
+  uint tscpertick;    // TSC cycles per timer interrupt, 0 if unknown
+};
+
+struct vdsoproc {
+  int pid;
+};
+
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+  uint tv_sec;
+  uint tv_nsec;
+};
+#endif
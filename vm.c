@@ -6,9 +6,13 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "vdso.h"
+#include "traps.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
+extern char sysenter_entry[];  // trapasm.S
+static int havesysenter;       // CPU supports SYSENTER/SYSEXIT
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -16,6 +20,7 @@ void
 seginit(void)
 {
   struct cpu *c;
+  uint edx;
 
   // Map "logical" addresses to virtual addresses using identity map.
   // Cannot share a CODE descriptor for both kernel and user
@@ -27,6 +32,22 @@ seginit(void)
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+
+  // Fast system calls. SYSENTER takes %cs from MSR_SYSENTER_CS and
+  // %ss from the next descriptor, and SYSEXIT uses the two after that,
+  // which is exactly the KCODE, KDATA, UCODE, UDATA order above.
+  // The kernel stack MSR is per process and set in switchuvm().
+  cpuidreg(1, 0, 0, 0, &edx);
+  if(edx & CPUID_SEP){
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3);
+    wrmsr(MSR_SYSENTER_EIP, (uint)sysenter_entry);
+    havesysenter = 1;
+  }
+
+  // Keep the kernel's PTE_G mappings in the TLB across switches
+  // between page tables.
+  if(edx & CPUID_PGE)
+    lcr4(rcr4() | CR4_PGE);
 }
 
 // Return the address of the PTE in page table pgdir
@@ -42,10 +63,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -114,34 +134,59 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
-pde_t*
-setupkvm(void)
+// Map [va, va+size) to pa in kpgdir as global pages, using a
+// single PTE_PS entry for each 4MB that is aligned in both.
+static int
+kmapglobal(uint va, uint size, uint pa, int perm)
+{
+  uint end = va + size;  // wraps to 0 for the last region
+
+  while(va != end){
+    if(va % BIGPGSIZE == 0 && pa % BIGPGSIZE == 0 && end - va >= BIGPGSIZE){
+      kpgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+      va += BIGPGSIZE;
+      pa += BIGPGSIZE;
+    } else {
+      if(mappages(kpgdir, (void*)va, PGSIZE, pa, perm | PTE_G) < 0)
+        return -1;
+      va += PGSIZE;
+      pa += PGSIZE;
+    }
+  }
+  return 0;
+}
+
+// Build the kernel part of the page tables, in kpgdir. Its page
+// tables are never changed afterwards, so every page directory
+// shares them (see setupkvm()).
+void
+kvmalloc(void)
 {
-  pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
-    return 0;
-  memset(pgdir, 0, PGSIZE);
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
-  return pgdir;
+    if(kmapglobal((uint)k->virt, k->phys_end - k->phys_start,
+                  (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
+  switchkvm();
 }
 
-// Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
-void
-kvmalloc(void)
+// Set up kernel part of a page table: point its directory entries
+// above KERNBASE at kpgdir's page tables.
+pde_t*
+setupkvm(void)
 {
-  kpgdir = setupkvm();
-  switchkvm();
+  pde_t *pgdir;
+
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
+    return 0;
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
+  return pgdir;
 }
 
 // Switch h/w page table register to the kernel-only page table,
@@ -150,6 +195,7 @@ void
 switchkvm(void)
 {
   lcr3(V2P(kpgdir));   // switch to the kernel page table
+  mycpu()->pgdir = 0;
 }
 
 // Switch TSS and h/w page table to correspond to process p.
@@ -173,10 +219,124 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  if(havesysenter)
+    wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE);
+  mycpu()->pgdir = p->pgdir;  // before the load; see tlbflush()
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
 
+// Above this many pages, tlbflush() reloads cr3 instead of
+// invalidating page by page.
+#define INVLPGMAX  32
+
+// Drop the TLB entries of pages [va, va+npages*PGSIZE) of pgdir,
+// whose PTEs the caller has changed, from every CPU that has pgdir
+// loaded: here with invlpg, or one cr3 reload for a large range,
+// and on other CPUs with a shootdown IPI (tlbintr()). Callers
+// change a whole range of PTEs and then flush once. A shootdown
+// waits for the other CPUs, so the caller must not hold spinlocks
+// if pgdir can be loaded elsewhere; interrupts may be off (as in a
+// page fault), since the wait serves shootdowns aimed at this CPU.
+void
+tlbflush(pde_t *pgdir, uint va, uint npages)
+{
+  struct cpu *me, *c;
+  int sent;
+  uint i;
+
+  if(npages == 0)
+    return;
+  pushcli();
+  me = mycpu();
+  if(me->pgdir == pgdir){
+    if(npages > INVLPGMAX)
+      lcr3(V2P(pgdir));
+    else
+      for(i = 0; i < npages; i++)
+        invlpg(va + i*PGSIZE);
+  }
+  sent = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c == me || c->pgdir != pgdir)
+      continue;
+    c->tlbstale = 1;
+    lapicipi(c->apicid, T_TLBFLUSH);
+    sent = 1;
+  }
+  popcli();
+  if(!sent)
+    return;
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(c->tlbstale){
+      pushcli();
+      if(mycpu()->tlbstale)
+        tlbintr();
+      popcli();
+    }
+}
+
+// Shootdown IPI: another CPU changed PTEs of the loaded page table.
+// Clear tlbstale before flushing, so that a request made after the
+// flush started is not taken as done.
+void
+tlbintr(void)
+{
+  struct cpu *c = mycpu();
+
+  c->tlbstale = 0;
+  if(c->pgdir)
+    lcr3(V2P(c->pgdir));
+}
+
+// Pages unmapped from pgdir but not yet freed: a page can only go
+// back to the allocator once no TLB still maps it, so unmappers
+// collect the pages of a range here and flush the TLB once for all.
+struct tlbgather {
+  pde_t *pgdir;
+  uint start, end;      // range covering the unmapped pages
+  int n;
+  char *pages[INVLPGMAX];
+};
+
+static void
+tlbgatherinit(struct tlbgather *g, pde_t *pgdir)
+{
+  g->pgdir = pgdir;
+  g->start = g->end = 0;
+  g->n = 0;
+}
+
+// Flush the gathered range and free its pages.
+static void
+tlbgatherflush(struct tlbgather *g)
+{
+  int i;
+
+  if(g->start < g->end)
+    tlbflush(g->pgdir, g->start, (g->end - g->start) / PGSIZE);
+  for(i = 0; i < g->n; i++)
+    kfree(g->pages[i]);
+  g->start = g->end = 0;
+  g->n = 0;
+}
+
+// The caller has cleared the PTE of va, which mapped mem.
+static void
+tlbgatherpage(struct tlbgather *g, uint va, char *mem)
+{
+  if(g->n == INVLPGMAX)
+    tlbgatherflush(g);
+  if(g->start == g->end){
+    g->start = va;
+    g->end = va + PGSIZE;
+  } else if(va < g->start)
+    g->start = va;
+  else if(va + PGSIZE > g->end)
+    g->end = va + PGSIZE;
+  g->pages[g->n++] = mem;
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -186,33 +346,22 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
+// Map the vdso pages read-only for the user at VDSOBASE (see vdso.h):
+// the shared kernel data page, then the process's own page.
+// Neither page belongs to the address space; freevm() stops
+// below VDSOBASE and leaves them alone.
 int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
+mapvdso(pde_t *pgdir, char *procpage)
 {
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
+  if(mappages(pgdir, (char*)VDSOBASE, PGSIZE, V2P(vdsopage), PTE_U) < 0)
+    return -1;
+  if(mappages(pgdir, (char*)VDSOPROC, PGSIZE, V2P(procpage), PTE_U) < 0)
+    return -1;
   return 0;
 }
 
@@ -224,20 +373,19 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > VDSOBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -255,12 +403,14 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  struct tlbgather g;
   pte_t *pte;
   uint a, pa;
 
   if(newsz >= oldsz)
     return oldsz;
 
+  tlbgatherinit(&g, pgdir);
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
     pte = walkpgdir(pgdir, (char*)a, 0);
@@ -270,11 +420,11 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
       *pte = 0;
+      tlbgatherpage(&g, a, P2V(pa));
     }
   }
+  tlbgatherflush(&g);
   return newsz;
 }
 
@@ -287,8 +437,8 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  deallocuvm(pgdir, VDSOBASE, 0);
+  for(i = 0; i < PDX(KERNBASE); i++){  // the kernel's are shared
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -311,39 +461,161 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The child shares the parent's pages:
+// writable pages become read-only and PTE_COW in both, and
+// cowpage() copies one when either process writes to it.
+// pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;  // no page table here
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;  // heap page not touched yet
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    }
+    kref(P2V(pa));
   }
+  tlbflush(pgdir, 0, PGROUNDUP(sz) / PGSIZE);  // now read-only
   return d;
 
 bad:
+  tlbflush(pgdir, 0, PGROUNDUP(sz) / PGSIZE);
   freevm(d);
   return 0;
 }
 
+// Make the copy-on-write page at user address va writable,
+// copying it first if another page table still shares it. The
+// zero page is replaced by a fresh zeroed page.
+// Returns -1 if va is not a copy-on-write page or there is
+// no memory for the copy.
+int
+cowpage(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem, *old;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  old = P2V(PTE_ADDR(*pte));
+  if(old == zeropage){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    *pte = V2P(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+  } else if(krefcount(old) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, old, PGSIZE);
+    *pte = V2P(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+    kfree(old);
+  } else
+    *pte = (*pte | PTE_W) & ~PTE_COW;
+  tlbflush(pgdir, va, 1);
+  return 0;
+}
+
+// Back the page at va with a zeroed page if va is in p's memory
+// but not yet mapped: growproc() only raises p->sz, and each heap
+// page is allocated when it is first touched. Program text and
+// data are read in from the executable the same way (execpage()).
+// write is 0 if the caller will only read the page; see execpage().
+// Returns -1 if va is not such a page, there is no memory or the
+// read fails.
+int
+lazypage(struct proc *p, uint va, int write)
+{
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  if(va >= p->sz)
+    return -1;
+  if((pte = walkpgdir(p->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P))
+    return -1;
+  if((mem = execpage(p, va, &perm, write)) == 0)
+    return -1;
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fault in the missing pages of [va, va+n) in the current process
+// before the kernel touches them, and if write is set copy the
+// copy-on-write ones too. execpage() sleeps, which is not allowed
+// under the spinlocks some paths (pipes, console) hold while copying
+// user data. Returns -1 if a page cannot be backed, so that the
+// system call fails instead of faulting in the kernel.
+int
+prefault(uint va, uint n, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a, last;
+
+  if(n == 0)
+    return 0;
+  last = PGROUNDDOWN(va + n - 1);
+  for(a = PGROUNDDOWN(va); ; a += PGSIZE){
+    if(((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P)) &&
+       lazypage(p, a, write) < 0)
+      return -1;
+    if(write && (*walkpgdir(p->pgdir, (char*)a, 0) & PTE_COW) &&
+       cowpage(p->pgdir, a) < 0)
+      return -1;
+    if(a == last)
+      break;
+  }
+  return 0;
+}
+
+// The kernel faulted on user address va of p, and the page could
+// not be backed for lack of memory. The kernel can not give up on
+// the access half way, so kill p and let the access finish on p's
+// own vdso page, mapped there for the kernel only; it goes away
+// with p. A vfork() child borrows its parent's memory, so the
+// parent is killed too. Returns -1 if va is not in p's memory or
+// there is not even a page table page for it.
+int
+faultkill(struct proc *p, uint va)
+{
+  pte_t *pte;
+  char *old;
+
+  va = PGROUNDDOWN(va);
+  if(va >= p->sz || (pte = walkpgdir(p->pgdir, (char*)va, 1)) == 0)
+    return -1;
+  old = (*pte & PTE_P) ? P2V(PTE_ADDR(*pte)) : 0;
+  kref(p->vdso);
+  *pte = V2P(p->vdso) | PTE_W | PTE_P;
+  tlbflush(p->pgdir, va, 1);
+  if(old)
+    kfree(old);
+  cprintf("pid %d %s: no memory for 0x%x--kill proc\n", p->pid, p->name, va);
+  p->killed = 1;
+  if(p->vfork)
+    p->parent->killed = 1;
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -367,10 +639,18 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if((pte == 0 || !(*pte & PTE_P)) && myproc() && pgdir == myproc()->pgdir){
+      lazypage(myproc(), va0, 1);
+      pte = walkpgdir(pgdir, (char*)va0, 0);
+    }
+    if(pte && (*pte & PTE_COW) && cowpage(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -6,13 +6,20 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "vdso.h"
+#include "traps.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fs.h"
+#include "slab.h"
+#include "buf.h"
+#include "swap.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
+extern char sysenter_entry[];  // trapasm.S
+static int havesysenter;       // CPU supports SYSENTER/SYSEXIT
 
 
 
@@ -25,13 +32,6 @@ pde_t *kpgdir;  // for use in scheduler()
 //   struct inode *ip;
 //   uint off;
 // };
-/////////////////////////////////////////////////////////
-// freemem system call
-extern int freemem_int;
-int freemem(){
-  return freemem_int;
-}
-
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -39,6 +39,7 @@ void
 seginit(void)
 {
   struct cpu *c;
+  uint edx;
 
   // Map "logical" addresses to virtual addresses using identity map.
   // Cannot share a CODE descriptor for both kernel and user
@@ -50,11 +51,28 @@ seginit(void)
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+
+  // Fast system calls. SYSENTER takes %cs from MSR_SYSENTER_CS and
+  // %ss from the next descriptor, and SYSEXIT uses the two after that,
+  // which is exactly the KCODE, KDATA, UCODE, UDATA order above.
+  // The kernel stack MSR is per process and set in switchuvm().
+  cpuidreg(1, 0, 0, 0, &edx);
+  if(edx & CPUID_SEP){
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3);
+    wrmsr(MSR_SYSENTER_EIP, (uint)sysenter_entry);
+    havesysenter = 1;
+  }
+
+  // Keep the kernel's PTE_G mappings in the TLB across switches
+  // between page tables.
+  if(edx & CPUID_PGE)
+    lcr4(rcr4() | CR4_PGE);
 }
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages. Returns 0 inside a
+// 4MB page (PTE_PS), which has no PTEs.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -62,13 +80,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -137,42 +156,68 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
-pde_t*
-setupkvm(void)
+// Map [va, va+size) to pa in kpgdir as global pages, using a
+// single PTE_PS entry for each 4MB that is aligned in both.
+static int
+kmapglobal(uint va, uint size, uint pa, int perm)
 {
-  pde_t *pgdir;
-  struct kmap *k;
+  uint end = va + size;  // wraps to 0 for the last region
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
-    return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
+  while(va != end){
+    if(va % BIGPGSIZE == 0 && pa % BIGPGSIZE == 0 && end - va >= BIGPGSIZE){
+      kpgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+      va += BIGPGSIZE;
+      pa += BIGPGSIZE;
+    } else {
+      if(mappages(kpgdir, (void*)va, PGSIZE, pa, perm | PTE_G) < 0)
+        return -1;
+      va += PGSIZE;
+      pa += PGSIZE;
     }
-  return pgdir;
+  }
+  return 0;
 }
 
-// Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// Build the kernel part of the page tables, in kpgdir. Its page
+// tables are never changed afterwards, so every page directory
+// shares them (see setupkvm()).
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(kmapglobal((uint)k->virt, k->phys_end - k->phys_start,
+                  (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
+// Set up kernel part of a page table: point its directory entries
+// above KERNBASE at kpgdir's page tables.
+pde_t*
+setupkvm(void)
+{
+  pde_t *pgdir;
+
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
+    return 0;
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
+  return pgdir;
+}
+
 // Switch h/w page table register to the kernel-only page table,
 // for when no process is running.
 void
 switchkvm(void)
 {
   lcr3(V2P(kpgdir));   // switch to the kernel page table
+  mycpu()->pgdir = 0;
 }
 
 // Switch TSS and h/w page table to correspond to process p.
@@ -196,10 +241,669 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  if(havesysenter)
+    wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE);
+  mycpu()->pgdir = p->pgdir;  // before the load; see tlbflush()
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
 
+// Above this many pages, tlbflush() reloads cr3 instead of
+// invalidating page by page.
+#define INVLPGMAX  32
+
+// Drop the TLB entries of pages [va, va+npages*PGSIZE) of pgdir,
+// whose PTEs the caller has changed, from every CPU that has pgdir
+// loaded: here with invlpg, or one cr3 reload for a large range,
+// and on other CPUs with a shootdown IPI (tlbintr()). Callers
+// change a whole range of PTEs and then flush once. A shootdown
+// waits for the other CPUs, so the caller must not hold spinlocks
+// if pgdir can be loaded elsewhere; interrupts may be off (as in a
+// page fault), since the wait serves shootdowns aimed at this CPU.
+void
+tlbflush(pde_t *pgdir, uint va, uint npages)
+{
+  struct cpu *me, *c;
+  int sent;
+  uint i;
+
+  if(npages == 0)
+    return;
+  pushcli();
+  me = mycpu();
+  if(me->pgdir == pgdir){
+    if(npages > INVLPGMAX)
+      lcr3(V2P(pgdir));
+    else
+      for(i = 0; i < npages; i++)
+        invlpg(va + i*PGSIZE);
+  }
+  sent = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c == me || c->pgdir != pgdir)
+      continue;
+    c->tlbstale = 1;
+    lapicipi(c->apicid, T_TLBFLUSH);
+    sent = 1;
+  }
+  popcli();
+  if(!sent)
+    return;
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(c->tlbstale){
+      pushcli();
+      if(mycpu()->tlbstale)
+        tlbintr();
+      popcli();
+    }
+}
+
+// Shootdown IPI: another CPU changed PTEs of the loaded page table.
+// Clear tlbstale before flushing, so that a request made after the
+// flush started is not taken as done.
+void
+tlbintr(void)
+{
+  struct cpu *c = mycpu();
+
+  c->tlbstale = 0;
+  if(c->pgdir)
+    lcr3(V2P(c->pgdir));
+}
+
+// Pages unmapped from pgdir but not yet freed: a page can only go
+// back to the allocator once no TLB still maps it, so unmappers
+// collect the pages of a range here and flush the TLB once for all.
+struct tlbgather {
+  pde_t *pgdir;
+  uint start, end;      // range covering the unmapped pages
+  int n;
+  char *pages[INVLPGMAX];
+};
+
+static void
+tlbgatherinit(struct tlbgather *g, pde_t *pgdir)
+{
+  g->pgdir = pgdir;
+  g->start = g->end = 0;
+  g->n = 0;
+}
+
+// Flush the gathered range and free its pages.
+static void
+tlbgatherflush(struct tlbgather *g)
+{
+  int i;
+
+  if(g->start < g->end)
+    tlbflush(g->pgdir, g->start, (g->end - g->start) / PGSIZE);
+  for(i = 0; i < g->n; i++)
+    kfree(g->pages[i]);
+  g->start = g->end = 0;
+  g->n = 0;
+}
+
+// The caller has cleared the PTE of va, which mapped mem.
+static void
+tlbgatherpage(struct tlbgather *g, uint va, char *mem)
+{
+  if(g->n == INVLPGMAX)
+    tlbgatherflush(g);
+  if(g->start == g->end){
+    g->start = va;
+    g->end = va + PGSIZE;
+  } else if(va < g->start)
+    g->start = va;
+  else if(va + PGSIZE > g->end)
+    g->end = va + PGSIZE;
+  g->pages[g->n++] = mem;
+}
+
+// Page replacement (Project 5). Private user pages are kept on a
+// circular list in the order they were mapped. When kalloc() finds
+// no free page, swapout() sweeps a clock hand around the list. A
+// page whose PTE_A bit is set gets a second chance: the bit is
+// cleared and the hand moves on. The first page not touched since
+// the last sweep is written to a free slot of the swap area. Its
+// PTE then holds the slot number and PTE_SWAP, and the next fault
+// on it reads it back (swapin()).
+//
+// The swap area is the SWAPBLOCKS blocks after the file system on
+// ROOTDEV. Pages go to and from it with direct disk requests, not
+// through the buffer cache.
+//
+// Ahead of the disk sits a pool of compressed pages, as in Linux's
+// zswap. A page swapped out is compressed (lzcompress()) and, if
+// that at least halves it, appended to the current pool page. The
+// pool grows by keeping the page being swapped out as a new pool
+// page; once it has ZSWAPMAX pages, the oldest pool page's entries
+// are written to their slots on disk to make room. A page still in
+// the pool comes back without any disk I/O. Either way the page
+// owns a slot, and the slot number names it in the PTE.
+//
+// A listed page belongs to the one page table that maps it.
+// Unmapping a page takes it off the list, and changes to the PTEs
+// of listed pages are made with swap.lock held, so swapout() never
+// sees a page half unmapped.
+//
+// A page shared copy-on-write since fork() is listed for at most
+// one of its mappings, and there is no reverse map to find the
+// others. If the listed mapping goes first (the process exits, or
+// writes the page and gets a copy), the page is off the list even
+// once a single mapping is left. It goes back on at that mapping's
+// next write, when cowpage() finds the page no longer shared; a
+// page the survivor only ever reads stays resident.
+
+#define NPAGE      (PHYSTOP/PGSIZE)
+#define NOPAGE     0xffff                   // end of list, as a pfn
+#define SLOTBLOCKS (PGSIZE/BSIZE)
+#define NSLOT      (SWAPBLOCKS/SLOTBLOCKS)
+
+#define ZSWAPMAX   256                      // most pool pages (1MB)
+#define ZMAXLEN    (PGSIZE/2)               // bigger ones go to disk
+#define LZHASH     1024                     // compressor hash table
+
+#define SWAPPED(pte)  (((pte) & (PTE_P|PTE_SWAP)) == PTE_SWAP)
+#define SWAPSLOT(pte) ((pte) >> PTXSHIFT)
+
+struct lrupage {
+  pde_t *pgdir;          // page table mapping the page, 0 if not listed
+  uint va;
+  ushort next, prev;     // pfns of the neighbours on the list
+};
+
+// Where the page in a slot is.
+struct zslot {
+  short zswpage;         // pool page holding it compressed, -1 if on disk
+  ushort off;            // where in the pool page
+  ushort len;            // compressed size
+};
+
+struct zswpage {
+  char *mem;             // 0 if this pool page is not allocated
+  ushort used;           // bytes appended so far
+  ushort nobj;           // of which entries still in use
+};
+
+struct {
+  struct spinlock lock;     // the list, slots, the pool, listed PTEs
+  struct sleeplock iolock;  // one page in or out at a time
+  struct lrupage page[NPAGE];
+  ushort hand;              // next page the clock looks at
+  uint npage;               // pages on the list
+  uchar used[NSLOT/8];      // slots in use
+  struct zslot slot[NSLOT];
+  struct zswpage zswpage[ZSWAPMAX];
+  int zcur;                 // pool page being appended to, or -1
+  int zhand;                // next pool page to write back
+  struct swapstat st;
+  // Under iolock:
+  struct buf buf;           // disk request
+  uchar zbuf[ZMAXLEN];      // page being compressed
+  ushort lztab[LZHASH];
+} swap;
+
+void
+swapinit(void)
+{
+  int i;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  initsleeplock(&swap.buf.lock, "swapbuf");
+  swap.hand = NOPAGE;
+  for(i = 0; i < NSLOT; i++)
+    swap.slot[i].zswpage = -1;
+  swap.zcur = -1;
+}
+
+// Put the page at physical address pa, which pgdir maps at va, on
+// the list, just behind the hand. Caller holds swap.lock.
+static void
+lruadd(pde_t *pgdir, uint va, uint pa)
+{
+  struct lrupage *e = &swap.page[pa / PGSIZE];
+  ushort pfn = pa / PGSIZE;
+
+  if(e->pgdir)
+    return;
+  e->pgdir = pgdir;
+  e->va = va;
+  if(swap.hand == NOPAGE){
+    e->next = e->prev = pfn;
+    swap.hand = pfn;
+  } else {
+    e->next = swap.hand;
+    e->prev = swap.page[swap.hand].prev;
+    swap.page[e->prev].next = pfn;
+    swap.page[swap.hand].prev = pfn;
+  }
+  swap.npage++;
+}
+
+// Take the page at pa off the list if pgdir maps it at va there.
+// Caller holds swap.lock.
+static void
+lrudel(pde_t *pgdir, uint va, uint pa)
+{
+  struct lrupage *e = &swap.page[pa / PGSIZE];
+  ushort pfn = pa / PGSIZE;
+
+  if(e->pgdir != pgdir || e->va != va)
+    return;
+  if(e->next == pfn)
+    swap.hand = NOPAGE;
+  else {
+    swap.page[e->prev].next = e->next;
+    swap.page[e->next].prev = e->prev;
+    if(swap.hand == pfn)
+      swap.hand = e->next;
+  }
+  e->pgdir = 0;
+  swap.npage--;
+}
+
+// pgdir now maps mem at va: list it if nothing else maps it.
+static void
+lrumap(pde_t *pgdir, uint va, char *mem)
+{
+  if(mem == zeropage || krefcount(mem) != 1)
+    return;
+  acquire(&swap.lock);
+  lruadd(pgdir, va, V2P(mem));
+  release(&swap.lock);
+}
+
+// Allocate a swap slot. Caller holds swap.lock.
+static int
+slotalloc(void)
+{
+  int i;
+
+  for(i = 0; i < NSLOT; i++)
+    if(!(swap.used[i/8] & (1 << (i%8)))){
+      swap.used[i/8] |= 1 << (i%8);
+      return i;
+    }
+  return -1;
+}
+
+// Read or write the page at mem from or to swap slot slot.
+// Caller holds swap.iolock.
+static void
+swaprw(uint slot, char *mem, int write)
+{
+  struct buf *b = &swap.buf;
+
+  acquiresleep(&b->lock);
+  b->dev = ROOTDEV;
+  b->blockno = FSSIZE + slot * SLOTBLOCKS;
+  b->flags = write ? B_DIRTY : 0;
+  b->addr = (uchar*)mem;
+  b->nblock = SLOTBLOCKS;
+  iderw(b);
+  releasesleep(&b->lock);
+}
+
+// Drop slot's entry from the pool, if it is there. A pool page
+// left empty is freed, unless new entries are going into it.
+// Caller holds swap.lock.
+static void
+zfree(uint slot)
+{
+  struct zslot *s = &swap.slot[slot];
+  struct zswpage *z;
+
+  if(s->zswpage < 0)
+    return;
+  z = &swap.zswpage[s->zswpage];
+  swap.st.zstored--;
+  swap.st.zbytes -= s->len;
+  if(--z->nobj == 0){
+    if(s->zswpage == swap.zcur)
+      z->used = 0;
+    else {
+      kfree(z->mem);
+      z->mem = 0;
+      swap.st.zpages--;
+    }
+  }
+  s->zswpage = -1;
+}
+
+// Caller holds swap.lock.
+static void
+slotfree(uint slot)
+{
+  zfree(slot);
+  swap.used[slot/8] &= ~(1 << (slot%8));
+}
+
+// A small LZ77 codec for swapped-out pages. The compressed form is
+// a run of items, each starting with a byte c:
+//   c < 0x80:  c+1 literal bytes follow
+//   c >= 0x80: copy (c & 0x7f) + 3 bytes from the 2-byte little-
+//              endian distance back that follows (may overlap)
+// Matches are found through a hash table of the last position of
+// each 3-byte string, without searching further back.
+#define LZMINMATCH  3
+#define LZMAXMATCH  (0x7f + LZMINMATCH)
+#define LZMAXLIT    0x80
+
+// Append literals src[from..to) to dst[*n..max). Returns -1 if
+// they do not fit.
+static int
+lzlit(uchar *src, uint from, uint to, uchar *dst, uint *n, uint max)
+{
+  uint k;
+
+  while(from < to){
+    k = to - from < LZMAXLIT ? to - from : LZMAXLIT;
+    if(*n + 1 + k > max)
+      return -1;
+    dst[(*n)++] = k - 1;
+    memmove(dst + *n, src + from, k);
+    *n += k;
+    from += k;
+  }
+  return 0;
+}
+
+// Compress the page at src into dst. Returns the compressed
+// length, or -1 if it would be longer than max.
+// Caller holds swap.iolock (for lztab).
+static int
+lzcompress(uchar *src, uchar *dst, uint max)
+{
+  ushort *tab = swap.lztab;  // position + 1, or 0
+  uint i, lit, n, len, h, cand;
+
+  memset(tab, 0, sizeof(swap.lztab));
+  n = lit = i = 0;
+  while(i + LZMINMATCH <= PGSIZE){
+    h = ((src[i] << 6) ^ (src[i+1] << 3) ^ src[i+2]) % LZHASH;
+    cand = tab[h];
+    tab[h] = i + 1;
+    len = 0;
+    if(cand-- > 0)
+      while(i + len < PGSIZE && len < LZMAXMATCH &&
+            src[cand + len] == src[i + len])
+        len++;
+    if(len < LZMINMATCH){
+      i++;
+      continue;
+    }
+    if(lzlit(src, lit, i, dst, &n, max) < 0 || n + 3 > max)
+      return -1;
+    dst[n++] = 0x80 | (len - LZMINMATCH);
+    dst[n++] = (i - cand) & 0xff;
+    dst[n++] = (i - cand) >> 8;
+    i += len;
+    lit = i;
+  }
+  if(lzlit(src, lit, PGSIZE, dst, &n, max) < 0)
+    return -1;
+  return n;
+}
+
+// Expand n bytes at src, from lzcompress(), into the page at dst.
+static void
+lzdecompress(uchar *src, uint n, uchar *dst)
+{
+  uint i, o, k, d;
+
+  i = o = 0;
+  while(i < n){
+    if(src[i] < 0x80){
+      k = src[i++] + 1;
+      if(o + k > PGSIZE)
+        panic("lzdecompress");
+      memmove(dst + o, src + i, k);
+      i += k;
+    } else {
+      k = (src[i++] & 0x7f) + LZMINMATCH;
+      d = src[i] | (src[i+1] << 8);
+      i += 2;
+      if(d == 0 || d > o || o + k > PGSIZE)
+        panic("lzdecompress");
+      for(; k > 0; k--, o++)
+        dst[o] = dst[o - d];
+      continue;
+    }
+    o += k;
+  }
+  if(o != PGSIZE)
+    panic("lzdecompress");
+}
+
+// Write the entries of pool page zp out to their slots on disk,
+// expanding each into buf first, leaving zp empty.
+// Caller holds swap.iolock and swap.lock, and zp is swap.zcur.
+static void
+zwriteback(int zp, char *buf)
+{
+  struct zslot *s;
+  uint slot;
+
+  for(slot = 0; slot < NSLOT && swap.zswpage[zp].nobj > 0; slot++){
+    s = &swap.slot[slot];
+    if(s->zswpage != zp)
+      continue;
+    lzdecompress((uchar*)swap.zswpage[zp].mem + s->off, s->len, (uchar*)buf);
+    zfree(slot);
+    swap.st.zwriteback++;
+    release(&swap.lock);
+    swaprw(slot, buf, 1);
+    acquire(&swap.lock);
+  }
+}
+
+// Put the len bytes in swap.zbuf, page mem compressed, into the pool
+// for slot. If there is no room and the pool may grow, mem itself
+// becomes a pool page, and zstore() returns 1: the caller must not
+// free it. Otherwise mem is used as a buffer for writing back the
+// oldest pool page, and zstore() returns 0. If the page has been
+// unmapped since swapout() took swap.lock, and its slot freed, the
+// entry is dropped.
+// Caller holds swap.iolock.
+static int
+zstore(uint slot, uint len, char *mem)
+{
+  struct zswpage *z;
+  int i, kept;
+
+  kept = 0;
+  acquire(&swap.lock);
+  if(swap.zcur < 0 || swap.zswpage[swap.zcur].used + len > PGSIZE){
+    for(i = 0; i < ZSWAPMAX && swap.zswpage[i].mem; i++)
+      ;
+    if(i < ZSWAPMAX){
+      swap.zswpage[i].mem = mem;
+      swap.zswpage[i].used = 0;
+      swap.zswpage[i].nobj = 0;
+      swap.st.zpages++;
+      swap.zcur = i;
+      kept = 1;
+    } else {
+      i = swap.zhand;
+      swap.zhand = (i + 1) % ZSWAPMAX;
+      swap.zcur = i;  // so that zfree() keeps it
+      zwriteback(i, mem);
+      swap.zswpage[i].used = 0;
+    }
+  }
+  if(!(swap.used[slot/8] & (1 << (slot%8)))){
+    release(&swap.lock);
+    return kept;
+  }
+  z = &swap.zswpage[swap.zcur];
+  memmove(z->mem + z->used, swap.zbuf, len);
+  swap.slot[slot].zswpage = swap.zcur;
+  swap.slot[slot].off = z->used;
+  swap.slot[slot].len = len;
+  z->used += len;
+  z->nobj++;
+  swap.st.zstored++;
+  swap.st.zbytes += len;
+  release(&swap.lock);
+  return kept;
+}
+
+// Make room for kalloc(): write one listed page out to swap and
+// free it. Only a process holding no spinlocks, and not already
+// moving a page, may wait for the disk, so anyone else gets -1.
+// Returns -1 too if no page or slot can be found.
+int
+swapout(void)
+{
+  struct lrupage *e;
+  pde_t *pgdir;
+  pte_t *pte;
+  char *mem;
+  uint n, va, pfn;
+  int slot, len, cansleep;
+
+  pushcli();
+  cansleep = mycpu()->ncli == 1 && mycpu()->proc != 0;
+  popcli();
+  if(!cansleep || holdingsleep(&swap.iolock))
+    return -1;
+
+  acquiresleep(&swap.iolock);
+  acquire(&swap.lock);
+  if((slot = slotalloc()) < 0)
+    goto none;
+  // Two turns clear every PTE_A bit on the way.
+  for(n = 2*swap.npage; n > 0 && swap.hand != NOPAGE; n--){
+    pfn = swap.hand;
+    e = &swap.page[pfn];
+    swap.hand = e->next;
+    pte = walkpgdir(e->pgdir, (void*)e->va, 0);
+    if(pte == 0 || PTE_ADDR(*pte) != pfn*PGSIZE || !(*pte & PTE_P))
+      panic("swapout");
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    if((*pte & PTE_COW) || krefcount(P2V(pfn*PGSIZE)) != 1)
+      continue;  // shared since fork
+    pgdir = e->pgdir;
+    va = e->va;
+    mem = P2V(pfn*PGSIZE);
+    lrudel(pgdir, va, pfn*PGSIZE);
+    *pte = (slot << PTXSHIFT) | (PTE_FLAGS(*pte) & ~(PTE_P|PTE_A|PTE_D)) | PTE_SWAP;
+    release(&swap.lock);
+
+    // Once no TLB maps it, the page can no longer change.
+    tlbflush(pgdir, va, 1);
+    swap.st.nout++;
+    if((len = lzcompress((uchar*)mem, swap.zbuf, ZMAXLEN)) < 0){
+      swap.st.zrejects++;
+      swaprw(slot, mem, 1);
+      kfree(mem);
+    } else if(zstore(slot, len, mem) == 0)
+      kfree(mem);
+    releasesleep(&swap.iolock);
+    return 0;
+  }
+  slotfree(slot);
+none:
+  release(&swap.lock);
+  releasesleep(&swap.iolock);
+  return -1;
+}
+
+// Read the swapped-out page at va in pgdir, the current page table,
+// back in. Returns -1 if it is not swapped out or there is no
+// memory.
+static int
+swapin(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem;
+  uint slot;
+  int z;
+
+  if((mem = kalloc()) == 0)  // may swap another page out
+    return -1;
+  acquiresleep(&swap.iolock);
+  acquire(&swap.lock);
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0 || !SWAPPED(*pte)){
+    release(&swap.lock);
+    releasesleep(&swap.iolock);
+    kfree(mem);
+    return -1;
+  }
+  slot = SWAPSLOT(*pte);
+  swap.st.nin++;
+  if((z = swap.slot[slot].zswpage) >= 0){
+    lzdecompress((uchar*)swap.zswpage[z].mem + swap.slot[slot].off,
+                 swap.slot[slot].len, (uchar*)mem);
+    swap.st.zhits++;
+  } else {
+    release(&swap.lock);
+    // Only this process changes its swapped-out PTEs.
+    swaprw(slot, mem, 0);
+    acquire(&swap.lock);
+  }
+  *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_P;
+  slotfree(slot);
+  lruadd(pgdir, va, V2P(mem));
+  release(&swap.lock);
+  releasesleep(&swap.iolock);
+  return 0;
+}
+
+// Clear the PTE at va in pgdir, taking its page off the list or
+// freeing its swap slot. Returns the page it mapped, or 0.
+static char*
+unmappte(pde_t *pgdir, uint va, pte_t *pte)
+{
+  char *mem = 0;
+
+  acquire(&swap.lock);
+  if(SWAPPED(*pte))
+    slotfree(SWAPSLOT(*pte));
+  else if(*pte & PTE_P){
+    lrudel(pgdir, va, PTE_ADDR(*pte));
+    mem = P2V(PTE_ADDR(*pte));
+  }
+  *pte = 0;
+  release(&swap.lock);
+  return mem;
+}
+
+// Copy the swap counters into *st.
+void
+swapstat(struct swapstat *st)
+{
+  int i;
+
+  acquire(&swap.lock);
+  *st = swap.st;
+  st->ndisk = 0;
+  for(i = 0; i < NSLOT; i++)
+    if((swap.used[i/8] & (1 << (i%8))) && swap.slot[i].zswpage < 0)
+      st->ndisk++;
+  release(&swap.lock);
+}
+
+// Take swap.lock for a change to the PTE at va in pgdir, the
+// current page table, reading its page back in first if it is
+// swapped out. Returns -1, without the lock, if it cannot be.
+static int
+lockpte(pde_t *pgdir, uint va, pte_t *pte)
+{
+  acquire(&swap.lock);
+  while(SWAPPED(*pte)){
+    release(&swap.lock);
+    if(swapin(pgdir, va) < 0)
+      return -1;
+    acquire(&swap.lock);
+  }
+  return 0;
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -209,33 +913,22 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
+// Map the vdso pages read-only for the user at VDSOBASE (see vdso.h):
+// the shared kernel data page, then the process's own page.
+// Neither page belongs to the address space; freevm() stops
+// below VDSOBASE and leaves them alone.
 int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
+mapvdso(pde_t *pgdir, char *procpage)
 {
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
+  if(mappages(pgdir, (char*)VDSOBASE, PGSIZE, V2P(vdsopage), PTE_U) < 0)
+    return -1;
+  if(mappages(pgdir, (char*)VDSOPROC, PGSIZE, V2P(procpage), PTE_U) < 0)
+    return -1;
   return 0;
 }
 
@@ -247,20 +940,19 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > VDSOBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -271,6 +963,22 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+#define BIGORDER  10  // kalloc_pages() order of a BIGPGSIZE page
+
+// Remove the 4MB page (see mmaphuge()) that maps va in pgdir and
+// drop the reference to it.
+static void
+bigunmap(pde_t *pgdir, uint va)
+{
+  pde_t *pde = &pgdir[PDX(va)];
+  char *mem;
+
+  mem = P2V(PTE_ADDR(*pde));
+  *pde = 0;
+  tlbflush(pgdir, va - va % BIGPGSIZE, 1);  // one entry covers it all
+  kfree_pages(mem, BIGORDER);
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -278,26 +986,30 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  struct tlbgather g;
   pte_t *pte;
-  uint a, pa;
+  char *mem;
+  uint a;
 
   if(newsz >= oldsz)
     return oldsz;
 
+  tlbgatherinit(&g, pgdir);
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS)
+      bigunmap(pgdir, a);
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
-      pa = PTE_ADDR(*pte);
-      if(pa == 0)
+    else if((*pte & (PTE_P|PTE_SWAP)) != 0){
+      if((mem = unmappte(pgdir, a, pte)) == P2V(0))
         panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
-      *pte = 0;
+      if(mem)
+        tlbgatherpage(&g, a, mem);
     }
   }
+  tlbgatherflush(&g);
   return newsz;
 }
 
@@ -310,9 +1022,9 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+  deallocuvm(pgdir, VDSOBASE, 0);
+  for(i = 0; i < PDX(KERNBASE); i++){  // the kernel's are shared
+    if((pgdir[i] & (PTE_P|PTE_PS)) == PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -334,48 +1046,240 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The child shares the parent's pages:
+// writable pages become read-only and PTE_COW in both, and
+// cowpage() copies one when either process writes to it.
+// pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;  // no page table here
+      continue;
+    }
+    if(lockpte(pgdir, i, pte) < 0)
+      goto bad;
+    if(!(*pte & PTE_P)){
+      release(&swap.lock);
+      continue;  // heap page not touched yet
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+    kref(P2V(pa));
+    release(&swap.lock);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0){
+      kfree(P2V(pa));
       goto bad;
     }
   }
+  tlbflush(pgdir, 0, PGROUNDUP(sz) / PGSIZE);  // now read-only
   return d;
 
 bad:
+  tlbflush(pgdir, 0, PGROUNDUP(sz) / PGSIZE);
   freevm(d);
   return 0;
 }
 
+// Make the copy-on-write page at user address va writable,
+// copying it first if another page table still shares it. The
+// zero page is replaced by a fresh zeroed page.
+// Returns -1 if va is not a copy-on-write page or there is
+// no memory for the copy.
+int
+cowpage(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem, *old;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  old = mem = P2V(PTE_ADDR(*pte));
+  if(old == zeropage){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+  } else if(krefcount(old) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, old, PGSIZE);
+  }
+  acquire(&swap.lock);
+  lrudel(pgdir, va, V2P(old));
+  *pte = V2P(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+  if(krefcount(mem) == 1)
+    lruadd(pgdir, va, V2P(mem));
+  release(&swap.lock);
+  tlbflush(pgdir, va, 1);
+  if(mem != old)
+    kfree(old);
+  return 0;
+}
+
+// Back the page at va with a zeroed page if va is in p's memory
+// but not yet mapped: growproc() only raises p->sz, and each heap
+// page is allocated when it is first touched. Program text and
+// data are read in from the executable the same way (execpage()).
+// write is 0 if the caller will only read the page; see execpage().
+// Returns -1 if va is not such a page, there is no memory or the
+// read fails.
+int
+lazypage(struct proc *p, uint va, int write)
+{
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && SWAPPED(*pte))
+    return swapin(p->pgdir, va);
+  if(va >= p->sz)
+    return -1;
+  if(pte && (*pte & PTE_P))
+    return -1;
+  if((mem = execpage(p, va, &perm, write)) == 0)
+    return -1;
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  lrumap(p->pgdir, va, mem);
+  return 0;
+}
+
+// Fault in the missing pages of [va, va+n) in the current process
+// before the kernel touches them, and if write is set copy the
+// copy-on-write ones too. execpage() and swapin() sleep, which is
+// not allowed under the spinlocks some paths (pipes, console) hold
+// while copying user data. So the pages are also taken off the list
+// until the system call returns (unpinuser()), for swapout() not to
+// take them back in the meantime. Returns -1 if a page cannot be
+// backed, so that the system call fails instead of faulting in the
+// kernel.
+int
+prefault(uint va, uint n, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a, last;
+
+  if(n == 0)
+    return 0;
+  last = PGROUNDDOWN(va + n - 1);
+  for(a = PGROUNDDOWN(va); ; ){
+    if(((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P)) &&
+       lazypage(p, a, write) < 0)
+      return -1;
+    if(write && (*walkpgdir(p->pgdir, (char*)a, 0) & PTE_COW) &&
+       cowpage(p->pgdir, a) < 0)
+      return -1;
+    // Another process's swapout() may have taken it again.
+    acquire(&swap.lock);
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(!(*pte & PTE_P) || (write && (*pte & PTE_COW))){
+      release(&swap.lock);
+      continue;
+    }
+    lrudel(p->pgdir, a, PTE_ADDR(*pte));
+    release(&swap.lock);
+    if(a == last)
+      break;
+    a += PGSIZE;
+  }
+
+  a = PGROUNDDOWN(va);
+  if(p->npin < NPIN){
+    p->pin[p->npin].va = a;
+    p->pin[p->npin++].end = last + PGSIZE;
+  } else {
+    // Out of ranges: widen the last one to cover this one too.
+    if(a < p->pin[NPIN-1].va)
+      p->pin[NPIN-1].va = a;
+    if(last + PGSIZE > p->pin[NPIN-1].end)
+      p->pin[NPIN-1].end = last + PGSIZE;
+  }
+  return 0;
+}
+
+// The system call is done with the pages prefault() kept in: put
+// those still mapped back on the list.
+void
+unpinuser(void)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a;
+  int i;
+
+  for(i = 0; i < p->npin; i++){
+    for(a = p->pin[i].va; a < p->pin[i].end; a += PGSIZE){
+      if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0){
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;  // no page table
+        continue;
+      }
+      if(*pte & PTE_P)
+        lrumap(p->pgdir, a, P2V(PTE_ADDR(*pte)));
+    }
+  }
+  p->npin = 0;
+}
+
+// The kernel faulted on user address va of p, and the page could
+// not be backed for lack of memory. The kernel can not give up on
+// the access half way, so kill p and let the access finish on p's
+// own vdso page, mapped there for the kernel only; it goes away
+// with p. A vfork() child borrows its parent's memory, so the
+// parent is killed too. Returns -1 if va is not in p's memory or
+// there is not even a page table page for it.
+int
+faultkill(struct proc *p, uint va)
+{
+  pte_t *pte;
+  char *old;
+
+  va = PGROUNDDOWN(va);
+  if(va >= p->sz || (pte = walkpgdir(p->pgdir, (char*)va, 1)) == 0)
+    return -1;
+  old = unmappte(p->pgdir, va, pte);
+  kref(p->vdso);
+  *pte = V2P(p->vdso) | PTE_W | PTE_P;
+  tlbflush(p->pgdir, va, 1);
+  if(old)
+    kfree(old);
+  cprintf("pid %d %s: no memory for 0x%x--kill proc\n", p->pid, p->name, va);
+  p->killed = 1;
+  if(p->vfork)
+    p->parent->killed = 1;
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
+  pde_t pde;
   pte_t *pte;
 
+  pde = pgdir[PDX(uva)];
+  if(pde & PTE_PS){
+    if((pde & PTE_U) == 0)
+      return 0;
+    return (char*)P2V(PTE_ADDR(pde)) + PGROUNDDOWN((uint)uva % BIGPGSIZE);
+  }
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -390,10 +1294,18 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if((pte == 0 || !(*pte & PTE_P)) && myproc() && pgdir == myproc()->pgdir){
+      lazypage(myproc(), va0, 1);
+      pte = walkpgdir(pgdir, (char*)va0, 0);
+    }
+    if(pte && (*pte & PTE_COW) && cowpage(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -416,75 +1328,491 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 // Blank page.
 
 
-#define MMAPBASE 0x40000000
 
-int map_file_into_memory(struct mmap_area *area) {
-  struct proc *curproc = myproc();
-  char *mem;
-  int current;
-  for (current = 0; current < (area->length); current += PGSIZE) {
-    // 메모리 할당
-    mem = kalloc();
-    if (mem == 0) {
-      return -1; // 메모리 할당 실패
+static struct kmem_cache mmapcache;
+
+void
+mmapinit(void)
+{
+  kmem_cache_init(&mmapcache, "mmapcache", sizeof(struct mmap_area), 0);
+}
+
+// p->mmaps is kept sorted by address, with no two mappings
+// overlapping. p->mmaphint remembers the last mapping found, since
+// faults tend to come in runs on the same mapping.
+// Only p itself (or fork, before the child runs) uses p->mmaps,
+// so no lock is needed.
+
+// Return p's mapping that contains va, or 0.
+struct mmap_area*
+findmmap(struct proc *p, uint va)
+{
+  struct mmap_area *a;
+
+  a = p->mmaphint;
+  if(a && a->addr <= va && va < a->addr + a->length)
+    return a;
+  for(a = p->mmaps; a && a->addr <= va; a = a->next)
+    if(va < a->addr + a->length){
+      p->mmaphint = a;
+      return a;
     }
-    // 페이지를 0으로 초기화
-    memset(mem, 0, PGSIZE);
-//     int tempsize=area->length;
-//     int r = 0;
-//     while (tempsize>0){
-//       int curroff = (area->offset) % PGSIZE;
-//       int currsize = PGSIZE - curroff > tempsize ? tempsize : PGSIZE - curroff;
-//       if (currsize > 0) {
-//         if (area->f->ip != 0){
-//           ilock(area->f->ip);
-//           r = readi(area->f->ip, mem, area->offset, currsize);
-//           iunlock(area->f->ip);
-//         }
-//         if (r != currsize) {
-//           kfree(mem);
-//           return -1;
-//         }
-//       }
-//       tempsize -= currsize;
-// //      area->offset = 0;
-//   }
-    fileread(area->f, mem, PGSIZE);
-
-    // 페이지 테이블에 매핑
-    if (mappages(curproc->pgdir, (void *)(area->addr + current), PGSIZE, V2P(mem), area->prot|PTE_U) < 0) {
-      return -1; // 페이지 매핑 실패
+  return 0;
+}
+
+// Does any of p's mappings overlap [start, end)?
+int
+mmapoverlap(struct proc *p, uint start, uint end)
+{
+  struct mmap_area *a;
+
+  for(a = p->mmaps; a && a->addr < end; a = a->next)
+    if(start < a->addr + a->length)
+      return 1;
+  return 0;
+}
+
+// Add a mapping of [addr, addr+length) to p, in address order.
+// Fails if the range wraps, reaches the vdso pages or overlaps
+// another mapping.
+static struct mmap_area*
+addmmap(struct proc *p, uint addr, int length)
+{
+  struct mmap_area *a, **pp;
+  uint end = addr + length;
+
+  if(end <= addr || end > VDSOBASE || mmapoverlap(p, addr, end))
+    return 0;
+  if((a = kmem_cache_alloc(&mmapcache)) == 0)
+    return 0;
+  a->p = p;
+  a->addr = addr;
+  a->length = length;
+  a->ranext = 0;
+  a->rawin = 0;
+  for(pp = &p->mmaps; *pp && (*pp)->addr < addr; pp = &(*pp)->next)
+    ;
+  a->next = *pp;
+  *pp = a;
+  return a;
+}
+
+// Forget mapping a. Does not touch the page table.
+static void
+delmmap(struct mmap_area *a)
+{
+  struct mmap_area **pp;
+
+  for(pp = &a->p->mmaps; *pp != a; pp = &(*pp)->next)
+    ;
+  *pp = a->next;
+  if(a->p->mmaphint == a)
+    a->p->mmaphint = 0;
+  if(a->f)
+    fileclose(a->f);
+  kmem_cache_free(&mmapcache, a);
+}
+
+// Write page mem, at va in file mapping a, back to the file.
+// Only the part inside the file is written; a mapping does not
+// extend its file.
+static void
+mmapwriteback(struct mmap_area *a, uint va, char *mem)
+{
+  struct inode *ip = a->f->ip;
+  uint off = a->offset + (va - a->addr);
+  uint i, n, max;
+
+  // Write a few blocks at a time, as filewrite() does, to
+  // avoid exceeding the maximum log transaction size.
+  max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  for(i = 0; i < PGSIZE; i += n){
+    begin_op();
+    ilock(ip);
+    n = 0;
+    if(off + i < ip->size){
+      n = PGSIZE - i;
+      if(n > ip->size - (off + i))
+        n = ip->size - (off + i);
+      if(n > max)
+        n = max;
+      writei(ip, mem + i, off + i, n);
     }
+    iunlock(ip);
+    end_op();
+    if(n == 0)
+      break;
   }
-  return area->addr;
 }
 
-int mmap_anonymous_populate(struct mmap_area *area){
-  struct proc *curproc = myproc();
+// Get the page for va in mapping a and the permissions to map it
+// with. Anonymous memory gets a zeroed page, or for a read fault
+// (write not set) on a private mapping the zero page, copy-on-
+// write; the first write then allocates. Files get the page from the page cache,
+// writable if MAP_SHARED and copy-on-write otherwise. If cached is
+// set, only take a file page that is already cached. Returns 0 if
+// the page cannot be had.
+static char*
+mmapget(struct mmap_area *a, uint va, int write, int cached, int *perm)
+{
+  struct inode *ip;
   char *mem;
+  uint off;
+
+  *perm = PTE_U;
+  if(a->f == 0 && !write && !(a->flags & MAP_SHARED)){
+    if(a->prot & PROT_WRITE)
+      *perm |= PTE_COW;
+    return zeropage;
+  }
+  if(a->f == 0){
+    if(cached || (mem = kalloc_zeroed()) == 0)
+      return 0;
+    if(a->prot & PROT_WRITE)
+      *perm |= PTE_W;
+    return mem;
+  }
+  ip = a->f->ip;
+  off = a->offset + (va - a->addr);
+  ilockshared(ip);
+  if(cached)
+    mem = pcpeek(ip, off);
+  else
+    mem = pcget(ip, off);
+  if(mem && (a->flags & MAP_SHARED) && pcshare(ip, off, mem, 1) < 0){
+    kfree(mem);
+    mem = 0;
+  }
+  if(mem == 0 && !cached && !(a->flags & MAP_SHARED) && off >= ip->size)
+    mem = kalloc_zeroed();  // past the end of the file
+  iunlockshared(ip);
+  if(mem && (a->prot & PROT_WRITE))
+    *perm |= (a->flags & MAP_SHARED) ? PTE_W : PTE_COW;
+  return mem;
+}
+
+// Give back page mem that mmapget() returned for va in a but that
+// did not get mapped.
+static void
+mmapput(struct mmap_area *a, uint va, char *mem)
+{
+  if(a->f && (a->flags & MAP_SHARED))
+    pcshare(a->f->ip, a->offset + (va - a->addr), mem, -1);
+  kfree(mem);
+}
+
+// Fault in page va of mapping a in the current process, for a
+// write or a read access (see mmapget()). If cached is set, only
+// take a file page that is already cached.
+// Returns -1 if the page is already there or cannot be had.
+int
+mmappage(struct mmap_area *a, uint va, int write, int cached)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if((pte = walkpgdir(p->pgdir, (void*)va, 0)) != 0 && SWAPPED(*pte))
+    return cached ? -1 : swapin(p->pgdir, va);
+  if(pte && (*pte & PTE_P))
+    return -1;
+  if((mem = mmapget(a, va, write, cached, &perm)) == 0)
+    return -1;
+  if(mappages(p->pgdir, (void*)va, PGSIZE, V2P(mem), perm) < 0){
+    mmapput(a, va, mem);
+    return -1;
+  }
+  if(a->f == 0 && !(a->flags & MAP_SHARED))
+    lrumap(p->pgdir, va, mem);
+  return 0;
+}
+
+// Map pages[0..n-1] at va onwards in pgdir with permissions perm,
+// walking the page directory once per page table rather than once
+// per page. Returns the number of pages mapped.
+static int
+mapbatch(pde_t *pgdir, uint va, char **pages, int n, int perm)
+{
+  pte_t *pte;
   int i;
 
-  for (i = 0; i < area -> length; i += PGSIZE) {
-      // 메모리 할당
-      mem = kalloc();
-      if (!mem) {
+  pte = 0;
+  for(i = 0; i < n; i++, va += PGSIZE, pte++){
+    if(pte == 0 || va % BIGPGSIZE == 0)
+      if((pte = walkpgdir(pgdir, (void*)va, 1)) == 0)
+        break;
+    if(*pte & PTE_P)
+      panic("remap");
+    *pte = V2P(pages[i]) | perm | PTE_P;
+  }
+  return i;
+}
+
+// MAP_HUGE: back the 4MB of mapping a around va in p with one
+// zeroed page of that size, in a single PTE_PS directory entry.
+// An empty page table left there by earlier mappings is freed.
+// Returns -1 if the entry is in use or there is no 4MB block.
+static int
+mmaphuge(struct proc *p, struct mmap_area *a, uint va)
+{
+  pde_t *pde = &p->pgdir[PDX(va)];
+  pte_t *pgtab;
+  char *mem;
+  int i;
+
+  va -= va % BIGPGSIZE;
+  if(*pde & PTE_PS)
+    return -1;
+  if(*pde & PTE_P){
+    pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
+    for(i = 0; i < NPTENTRIES; i++)
+      if(pgtab[i])  // mapped or swapped out
         return -1;
-      }
+    *pde = 0;
+    tlbflush(p->pgdir, va, 1);
+    kfree((char*)pgtab);
+  }
+  if((mem = kalloc_pages(BIGORDER)) == 0)
+    return -1;
+  memset(mem, 0, BIGPGSIZE);
+  *pde = V2P(mem) | PTE_P | PTE_PS | PTE_U | ((a->prot & PROT_WRITE) ? PTE_W : 0);
+  return 0;
+}
+
+#define POPBATCH 32  // pages MAP_POPULATE gathers before mapping
 
-      // 메모리를 0으로 초기화
-      memset(mem, 0, PGSIZE);
+// MAP_POPULATE: fill all of a fresh mapping a batch at a time.
+// Anonymous pages are allocated together and cleared; file pages
+// come from the page cache, which reads a missing page with as few
+// disk requests as its blocks allow (readipage()). Each batch is
+// then entered with mapbatch(). On failure, pages already mapped
+// are left for the caller to remove with the mapping.
+static int
+mmappopulate(struct mmap_area *a)
+{
+  struct proc *p = myproc();
+  char *pages[POPBATCH];
+  uint va, end;
+  int i, n, m, perm;
 
-      // 페이지 테이블에 메모리 매핑
-      if (mappages(curproc->pgdir, (void *)(area->addr + i), PGSIZE, V2P(mem), area->prot|PTE_U) < 0) {
-          // 실패한 경우 메모리를 해제하고 오류 반환
-          deallocuvm(curproc->pgdir, area->addr + i - PGSIZE, area->addr + i);
-          kfree(mem);
+  end = a->addr + a->length;
+  if(a->flags & MAP_HUGE){
+    for(va = a->addr; va < end; va += BIGPGSIZE)
+      if(mmaphuge(p, a, va) < 0)
+        return -1;
+    return 0;
+  }
+  for(va = a->addr; va < end; va += n*PGSIZE){
+    n = (end - va + PGSIZE - 1) / PGSIZE;
+    if(n > POPBATCH)
+      n = POPBATCH;
+    if(a->f == 0){
+      if((m = kalloc_batch(pages, n)) < n){
+        while(m > 0)
+          kfree(pages[--m]);
+        return -1;
+      }
+      for(i = 0; i < n; i++)
+        memset(pages[i], 0, PGSIZE);
+      perm = PTE_U | ((a->prot & PROT_WRITE) ? PTE_W : 0);
+    } else {
+      for(i = 0; i < n; i++){
+        if((pages[i] = mmapget(a, va + i*PGSIZE, 1, 0, &perm)) == 0){
+          while(i > 0){
+            i--;
+            mmapput(a, va + i*PGSIZE, pages[i]);
+          }
           return -1;
+        }
+      }
+    }
+    m = mapbatch(p->pgdir, va, pages, n, perm);
+    if(a->f == 0 && !(a->flags & MAP_SHARED))
+      for(i = 0; i < m; i++)
+        lrumap(p->pgdir, va + i*PGSIZE, pages[i]);
+    if(m < n){
+      for(i = m; i < n; i++)
+        mmapput(a, va + i*PGSIZE, pages[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+#define RAMAX  16  // most pages one mmap fault maps
+
+// Handle a fault on page va of mapping a, for a write if write is
+// set. Besides va, map the
+// pages after it that a sequential scan will want next: the
+// window doubles, up to RAMAX pages, while each fault lands just
+// past the pages the last one mapped, and drops back to one page
+// when a fault lands anywhere else. File pages near va that are
+// already cached are mapped too, since they cost no I/O.
+int
+mmapfault(struct mmap_area *a, uint va, int write)
+{
+  uint v, end, around;
+  int n;
+
+  if(a->flags & MAP_HUGE)
+    return mmaphuge(myproc(), a, va);
+  if(mmappage(a, va, write, 0) < 0)
+    return -1;
+
+  n = 1;
+  if(va == a->ranext)
+    n = a->rawin*2 < RAMAX ? a->rawin*2 : RAMAX;
+  a->rawin = n;
+  end = a->addr + a->length;
+  for(v = va + PGSIZE; v < va + n*PGSIZE && v < end; v += PGSIZE)
+    if(mmappage(a, v, write, 0) < 0)
+      break;
+  a->ranext = v;
+
+  if(a->f){
+    around = a->addr + (va - a->addr) / (RAMAX*PGSIZE) * (RAMAX*PGSIZE);
+    for(v = around; v < around + RAMAX*PGSIZE && v < end; v += PGSIZE)
+      mmappage(a, v, 0, 1);
+  }
+  return 0;
+}
+
+// Remove page va of mapping a from p's page table, writing it back
+// first if it is a MAP_SHARED file page that p has written. The
+// page is freed once g is flushed.
+static void
+mmapunmap(struct proc *p, struct mmap_area *a, uint va, struct tlbgather *g)
+{
+  pte_t *pte;
+  char *mem;
+
+  if((pte = walkpgdir(p->pgdir, (void*)va, 0)) == 0 || !(*pte & PTE_P)){
+    if(pte && SWAPPED(*pte))
+      unmappte(p->pgdir, va, pte);
+    return;
+  }
+  mem = P2V(PTE_ADDR(*pte));
+  if(a->f && (a->flags & MAP_SHARED)){
+    if(*pte & PTE_D)
+      mmapwriteback(a, va, mem);
+    pcshare(a->f->ip, a->offset + (va - a->addr), mem, -1);
+  }
+  tlbgatherpage(g, va, unmappte(p->pgdir, va, pte));
+}
+
+// Remove mapping a and its pages from p.
+static void
+mmapdel(struct proc *p, struct mmap_area *a)
+{
+  struct tlbgather g;
+  uint off;
+
+  if(p->pgdir && (a->flags & MAP_HUGE)){
+    for(off = 0; off < a->length; off += BIGPGSIZE)
+      if(p->pgdir[PDX(a->addr + off)] & PTE_PS)
+        bigunmap(p->pgdir, a->addr + off);
+  } else if(p->pgdir){
+    tlbgatherinit(&g, p->pgdir);
+    for(off = 0; off < a->length; off += PGSIZE)
+      mmapunmap(p, a, a->addr + off, &g);
+    tlbgatherflush(&g);
+  }
+  delmmap(a);
+}
+
+// Give child the 4MB pages of MAP_HUGE mapping a that parent has
+// touched: shared ones as they are, private ones copied, since
+// copying on write would stall a later fault for a 4MB copy anyway.
+static int
+mmapduphuge(struct proc *parent, struct proc *child, struct mmap_area *a)
+{
+  pde_t pde;
+  char *mem;
+  uint va;
+
+  for(va = a->addr; va < a->addr + a->length; va += BIGPGSIZE){
+    pde = parent->pgdir[PDX(va)];
+    if(!(pde & PTE_PS))
+      continue;
+    mem = P2V(PTE_ADDR(pde));
+    if(a->flags & MAP_SHARED)
+      kref(mem);
+    else {
+      if((mem = kalloc_pages(BIGORDER)) == 0)
+        return -1;
+      memmove(mem, P2V(PTE_ADDR(pde)), BIGPGSIZE);
+    }
+    child->pgdir[PDX(va)] = V2P(mem) | (PTE_FLAGS(pde) & ~PTE_D);
+  }
+  return 0;
+}
+
+// Give child each of parent's mappings, sharing the pages parent
+// has touched so far: MAP_SHARED pages as they are, the others
+// copy-on-write.
+int
+mmapdup(struct proc *parent, struct proc *child)
+{
+  struct mmap_area *a, *na;
+  pte_t *pte;
+  char *mem;
+  uint off, flags;
+  int r;
+
+  r = 0;
+  for(a = parent->mmaps; a && r == 0; a = a->next){
+    if((na = addmmap(child, a->addr, a->length)) == 0){
+      r = -1;
+      break;
+    }
+    na->f = a->f ? filedup(a->f) : 0;
+    na->offset = a->offset;
+    na->prot = a->prot;
+    na->flags = a->flags;
+    if(a->flags & MAP_HUGE){
+      r = mmapduphuge(parent, child, a);
+      continue;
+    }
+    for(off = 0; off < a->length; off += PGSIZE){
+      pte = walkpgdir(parent->pgdir, (void*)(a->addr + off), 0);
+      if(pte == 0)
+        continue;
+      if(lockpte(parent->pgdir, a->addr + off, pte) < 0){
+        r = -1;
+        break;
       }
+      if(!(*pte & PTE_P)){
+        release(&swap.lock);
+        continue;
+      }
+      if(!(a->flags & MAP_SHARED) && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      mem = P2V(PTE_ADDR(*pte));
+      flags = PTE_FLAGS(*pte) & ~PTE_D;  // parent writes back its own
+      kref(mem);
+      release(&swap.lock);
+      if(mappages(child->pgdir, (void*)(a->addr + off), PGSIZE, V2P(mem), flags) < 0){
+        kfree(mem);
+        r = -1;
+        break;
+      }
+      if(na->f && (na->flags & MAP_SHARED))
+        pcshare(na->f->ip, na->offset + off, mem, 1);
+    }
+    if(!(a->flags & MAP_SHARED))  // flush the now copy-on-write entries
+      tlbflush(parent->pgdir, a->addr, PGROUNDUP(a->length) / PGSIZE);
   }
-  return area->addr;
+  return r;
 }
 
+// Drop all of p's mappings and their pages.
+void
+mmapexit(struct proc *p)
+{
+  while(p->mmaps)
+    mmapdel(p, p->mmaps);
+}
 
 uint
 mmap(uint addr, int length, int prot, int flags, int fd, int offset){
@@ -498,14 +1826,21 @@ mmap(uint addr, int length, int prot, int flags, int fd, int offset){
   }
 
   if (!(flags & MAP_ANONYMOUS)) {  // MAP_ANONYMOUS가 설정되어 있지 않을때 fd 확인
-    if (fd == -1 || (file = curproc->ofile[fd]) == 0){
+    if (fd < 0 || fd >= NOFILE || (file = curproc->ofile[fd]) == 0){
       return 0;
     }
+  if (file->type != FD_INODE)
+    return 0;
+  // Shared pages are cached by page-aligned file offset.
+  if ((flags & MAP_SHARED) && offset % PGSIZE != 0)
+    return 0;
 
   if ((prot & PROT_READ) && !file->readable)
     return 0; // File is not readable, but PROT_READ is requested
   if ((prot & PROT_WRITE) && !file->writable)
     return 0; // File is not writable, but PROT_WRITE is requested
+  if ((prot & PROT_WRITE) && (flags & MAP_SHARED) && file->ip->ntext > 0)
+    return 0; // A running program; see itext()
   } else {
     file = 0; // MAP_ANONYMOUS가 설정되어 있을 경우 file은 NULL
   }
@@ -515,37 +1850,32 @@ mmap(uint addr, int length, int prot, int flags, int fd, int offset){
     return 0;
   }
 
-  int i;
-  for (i=0; i < 64; i++){  //빈 공간 (현재 사용되지 않는 mmap_area 구조체)을 찾는 코드
-    if (mmap_areas[i].f == 0) {
-      area = &mmap_areas[i];
-      break;
-    }
+  // Huge mappings are anonymous and take whole 4MB pages.
+  if (flags & MAP_HUGE) {
+    if (file || start_addr % BIGPGSIZE != 0 || (uint)length > VDSOBASE)
+      return 0;
+    length = (length + BIGPGSIZE - 1) & ~(BIGPGSIZE - 1);
   }
 
-  area->f = file;
-  area->addr = start_addr;
-  area->length = length;
+  // Keep clear of the heap; growproc() likewise stops short of
+  // the mappings.
+  if (start_addr < curproc->sz)
+    return 0;
+  if ((area = addmmap(curproc, start_addr, length)) == 0)
+    return 0;
+  area->f = file ? filedup(file) : 0;
   area->offset = offset;
   area->prot = prot;
   area->flags = flags;
-  area->p = curproc;
 
   if (flags & MAP_POPULATE){
-    if (flags & MAP_ANONYMOUS) {  // 3번 case 
-      if (mmap_anonymous_populate(area) < 0) {
-        return 0;
-      }
-    } else{
-      if (map_file_into_memory(area) < 0) {
-        return 0;
-      }
+    if (mmappopulate(area) < 0) {
+      mmapdel(curproc, area);
+      return 0;
     }
-  } else{
-    // 지연된 매핑: 페이지 폴트가 발생할 때까지 기다립니다.
-    // 이 경우 페이지 폴트 핸들러가 작업을 수행해야 합니다.
-    mmap_areas[i] = *area;
   }
+  // 지연된 매핑: 페이지 폴트가 발생할 때까지 기다립니다.
+  // 이 경우 페이지 폴트 핸들러가 작업을 수행해야 합니다.
   return start_addr;
 }
 
@@ -553,40 +1883,19 @@ mmap(uint addr, int length, int prot, int flags, int fd, int offset){
 /////////////////////////////////
 int munmap(uint addr) {
     struct proc *curproc = myproc();
-    struct mmap_area *area = 0;
-    int i;
+    struct mmap_area *area;
     if (addr % PGSIZE != 0){
       return 0;
     }
     // 주어진 주소에 해당하는 mmap_area 찾기
-    for (i = 0; i < 64; i++) {
-        if (mmap_areas[i].addr == addr) {
-            area = &mmap_areas[i];
-            break;
-        }
-    }
+    area = findmmap(curproc, addr);
     // 2번: 해당 주소에 대한 mmap_area가 없는 경우
-    if (!area) {
+    if (!area || area->addr != addr) {
         return -1;
     }
 
-    // 3번
-    pte_t *pte;
-    uint offset;
-    for (offset = 0; offset < area->length; offset += PGSIZE) {
-        pte = walkpgdir(curproc->pgdir, (const void *)(addr + offset), 0);
-        if (pte && (*pte & PTE_P)) {  // 페이지가 이미 할당되었는지 확인
-            char *vir_addr = P2V(PTE_ADDR(*pte));
-            memset(vir_addr, 1, PGSIZE);  // 페이지를 1로 채우기
-            kfree(vir_addr);  // 물리 페이지 해제
-            *pte = 0;  // 페이지 테이블 항목 초기화
-        }
-    }
-
-    // 4번: mmap_area 구조체 제거
-    for (int j = i; j < 64; j++) {
-        mmap_areas[j] = mmap_areas[j + 1];
-    }
+    // 3번, 4번: 페이지와 mmap_area 제거
+    mmapdel(curproc, area);
 
     return 1;  
 }